@@ -5,203 +5,939 @@
 
 #include "QtPropertySerializer.h"
 
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <QAtomicInt>
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QFile>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QFutureInterface>
+#include <QHash>
+#include <QJsonArray>
 #include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+#include <QJsonValue>
+#include <QLocale>
+#include <QMetaMethod>
 #include <QMetaObject>
 #include <QMetaProperty>
-#include <QTextStream>
+#include <QMutex>
+#include <QPair>
+#include <QReadWriteLock>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QScopedPointer>
+#include <QSemaphore>
+#include <QSet>
+#include <QSignalBlocker>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QtNumeric>
 #include <QVariantList>
+#include <QVector>
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+#include <QCborArray>
+#include <QCborMap>
+#include <QCborStreamReader>
+#include <QCborStreamWriter>
+#include <QCborValue>
+#endif
 
 namespace QtPropertySerializer
 {
-    QVariantMap serialize(const QObject *object, int childDepth, bool includeReadOnlyProperties)
+    namespace
     {
-        QVariantMap data;
-        if(!object)
-            return data;
-        // Properties.
-        const QMetaObject *metaObject = object->metaObject();
-        int propertyCount = metaObject->propertyCount();
-        for(int i = 0; i < propertyCount; ++i) {
-            const QMetaProperty metaProperty = metaObject->property(i);
-            if(metaProperty.isReadable() && (includeReadOnlyProperties || metaProperty.isWritable())) {
-                const QByteArray propertyName = QByteArray(metaProperty.name());
+        /* --------------------------------------------------------------------------------
+         * Per-class property plan.
+         * Built once per QMetaObject so that serialization does not have to rebuild each
+         * QMetaProperty and look properties up by name for every object.
+         * -------------------------------------------------------------------------------- */
+        struct PropertyPlan
+        {
+            // All of the class's properties indexed by property index.
+            QVector<QMetaProperty> properties;
+            // Interned map keys (i.e. property names) indexed by property index.
+            QVector<QString> keys;
+            // Indexes of readable properties, and of readable AND writable properties.
+            QVector<int> readableIndexes;
+            QVector<int> readWriteIndexes;
+            // Map key --> property index.
+            QHash<QString, int> indexOfKey;
+            // Typed bindings indexed by property index (empty read function if not bound).
+            QVector<PropertyBinding> bindings;
+            
+            QVariant read(int index, const QObject *object) const
+            {
+                const PropertyBinding &binding = bindings.at(index);
+                if(!binding.read)
+                    return properties.at(index).read(object);
+                BoundValue value;
+                binding.read(object, value);
+                return value.toVariant();
+            }
+            
+            bool write(int index, QObject *object, const QVariant &value) const
+            {
+                const PropertyBinding &binding = bindings.at(index);
+                return binding.write ? binding.write(object, value) : properties.at(index).write(object, value);
+            }
+        };
+        
+        typedef QSharedPointer<const PropertyPlan> PropertyPlanPointer;
+        
+        // Cached plans and registered bindings.
+        struct PropertyPlanCache
+        {
+            QReadWriteLock lock;
+            QHash<const QMetaObject*, PropertyPlanPointer> plans;
+            QHash<const QMetaObject*, QVector<PropertyBinding> > bindings;
+            // Incremented whenever bindings are registered so that plans built from old bindings are not cached.
+            int generation;
+            
+            PropertyPlanCache() : generation(0) {}
+        };
+        
+        PropertyPlanCache& propertyPlanCache()
+        {
+            static PropertyPlanCache cache;
+            return cache;
+        }
+        
+        PropertyPlanPointer propertyPlan(const QMetaObject *metaObject)
+        {
+            PropertyPlanCache &cache = propertyPlanCache();
+            // Bindings for the class and its base classes, nearest class first.
+            QVector<QVector<PropertyBinding> > classBindings;
+            int generation;
+            {
+                QReadLocker locker(&cache.lock);
+                PropertyPlanPointer plan = cache.plans.value(metaObject);
+                if(plan)
+                    return plan;
+                for(const QMetaObject *superClass = metaObject; superClass; superClass = superClass->superClass()) {
+                    QHash<const QMetaObject*, QVector<PropertyBinding> >::const_iterator it = cache.bindings.constFind(superClass);
+                    if(it != cache.bindings.constEnd())
+                        classBindings.append(it.value());
+                }
+                generation = cache.generation;
+            }
+            QSharedPointer<PropertyPlan> plan(new PropertyPlan);
+            const int propertyCount = metaObject->propertyCount();
+            plan->properties.reserve(propertyCount);
+            plan->keys.reserve(propertyCount);
+            plan->indexOfKey.reserve(propertyCount);
+            plan->bindings.resize(propertyCount);
+            for(int i = 0; i < propertyCount; ++i) {
+                const QMetaProperty metaProperty = metaObject->property(i);
+                const QString key = QString::fromUtf8(metaProperty.name());
+                plan->properties.append(metaProperty);
+                plan->keys.append(key);
+                plan->indexOfKey.insert(key, i);
+                if(metaProperty.isReadable()) {
+                    plan->readableIndexes.append(i);
+                    if(metaProperty.isWritable())
+                        plan->readWriteIndexes.append(i);
+                }
+            }
+            // Bindings of nearer classes take precedence.
+            for(int j = classBindings.size() - 1; j >= 0; --j) {
+                for(const PropertyBinding &binding : classBindings.at(j)) {
+                    const int index = plan->indexOfKey.value(binding.key, -1);
+                    if(index != -1 && binding.read)
+                        plan->bindings[index] = binding;
+                }
+            }
+            QWriteLocker locker(&cache.lock);
+            if(generation != cache.generation)
+                return plan;
+            // Another thread may have beaten us to it, in which case use its plan.
+            PropertyPlanPointer &cachedPlan = cache.plans[metaObject];
+            if(!cachedPlan)
+                cachedPlan = plan;
+            return cachedPlan;
+        }
+        
+        // Add n to a counter in the totals and in the breakdown for className.
+        void count(Statistics *statistics, const QByteArray &className, int Statistics::Counts::*counter, int n = 1)
+        {
+            statistics->counts.*counter += n;
+            statistics->classCounts[className].*counter += n;
+        }
+        
+        /* --------------------------------------------------------------------------------
+         * Times a public call for statistics (does nothing if statistics is NULL).
+         * The part of the call's time not spent creating, matching, reading or writing
+         * objects is attributed to the remainder phase (e.g. parsing for readJson()).
+         * -------------------------------------------------------------------------------- */
+        class StatisticsTimer
+        {
+        public:
+            StatisticsTimer(Statistics *statistics, qint64 Statistics::*remainder = NULL) :
+            _statistics(statistics), _remainder(remainder), _objectNsecs(0)
+            {
+                if(_statistics) {
+                    _objectNsecs = objectNsecs();
+                    _timer.start();
+                }
+            }
+            
+            ~StatisticsTimer()
+            {
+                if(!_statistics)
+                    return;
+                const qint64 nsecs = _timer.nsecsElapsed();
+                _statistics->totalNsecs += nsecs;
+                if(_remainder)
+                    _statistics->*_remainder += nsecs - (objectNsecs() - _objectNsecs);
+            }
+            
+        private:
+            qint64 objectNsecs() const
+            {
+                return _statistics->createNsecs + _statistics->matchNsecs + _statistics->readNsecs + _statistics->writeNsecs;
+            }
+            
+            Statistics *_statistics;
+            qint64 Statistics::*_remainder;
+            qint64 _objectNsecs;
+            QElapsedTimer _timer;
+        };
+        
+        /* --------------------------------------------------------------------------------
+         * Binary arrays.
+         * QVector and QList of int, qint64, float or double, and QByteArray, are encoded as
+         * blocks of little-endian elements rather than one value per element.
+         * -------------------------------------------------------------------------------- */
+        // Copy count elements of size bytes each between host and little-endian byte order.
+        void copyLittleEndian(const void *source, void *destination, int count, int size)
+        {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+            std::memcpy(destination, source, size_t(count) * size_t(size));
+#else
+            const char *from = static_cast<const char*>(source);
+            char *to = static_cast<char*>(destination);
+            for(int i = 0; i < count; ++i, from += size, to += size) {
+                for(int j = 0; j < size; ++j)
+                    to[j] = from[size - 1 - j];
+            }
+#endif
+        }
+        
+        template <class T>
+        QByteArray packArray(const QVector<T> &values)
+        {
+            QByteArray bytes(values.size() * int(sizeof(T)), Qt::Uninitialized);
+            copyLittleEndian(values.constData(), bytes.data(), values.size(), int(sizeof(T)));
+            return bytes;
+        }
+        
+        template <class T>
+        QVector<T> unpackArray(const QByteArray &bytes)
+        {
+            if(bytes.size() % int(sizeof(T)))
+                throw std::runtime_error("QtPropertySerializer: Binary array size is not a multiple of its element size");
+            QVector<T> values(bytes.size() / int(sizeof(T)));
+            copyLittleEndian(bytes.constData(), values.data(), values.size(), int(sizeof(T)));
+            return values;
+        }
+        
+        template <class T>
+        QByteArray packVector(const QVariant &value) { return packArray(value.value<QVector<T> >()); }
+        template <class T>
+        QByteArray packList(const QVariant &value) { return packArray(value.value<QList<T> >().toVector()); }
+        template <class T>
+        QVariant unpackVector(const QByteArray &bytes) { return QVariant::fromValue(unpackArray<T>(bytes)); }
+        template <class T>
+        QVariant unpackList(const QByteArray &bytes) { return QVariant::fromValue(unpackArray<T>(bytes).toList()); }
+        QByteArray packBytes(const QVariant &value) { return value.toByteArray(); }
+        QVariant unpackBytes(const QByteArray &bytes) { return bytes; }
+        
+        struct BinaryArrayType
+        {
+            int userType;
+            QString typeName; // "$type" in JSON.
+            quint64 cborTag; // RFC 8746 little-endian typed array tag, or 0 for a plain byte string.
+            QByteArray (*pack)(const QVariant &value);
+            QVariant (*unpack)(const QByteArray &bytes);
+        };
+        
+        template <class Container>
+        BinaryArrayType makeBinaryArrayType(quint64 cborTag, QByteArray (*pack)(const QVariant&), QVariant (*unpack)(const QByteArray&))
+        {
+            const int userType = qMetaTypeId<Container>();
+            const BinaryArrayType type = {userType, QString::fromLatin1(QMetaType::typeName(userType)), cborTag, pack, unpack};
+            return type;
+        }
+        
+        const QVector<BinaryArrayType>& binaryArrayTypes()
+        {
+            // QVector before QList so that typed arrays in CBOR are read as QVector (see adaptBinaryArray()).
+            static const QVector<BinaryArrayType> types = QVector<BinaryArrayType>()
+            << makeBinaryArrayType<QByteArray>(0, packBytes, unpackBytes)
+            << makeBinaryArrayType<QVector<int> >(78, packVector<int>, unpackVector<int>)
+            << makeBinaryArrayType<QVector<qint64> >(79, packVector<qint64>, unpackVector<qint64>)
+            << makeBinaryArrayType<QVector<float> >(85, packVector<float>, unpackVector<float>)
+            << makeBinaryArrayType<QVector<double> >(86, packVector<double>, unpackVector<double>)
+            << makeBinaryArrayType<QList<int> >(78, packList<int>, unpackList<int>)
+            << makeBinaryArrayType<QList<qint64> >(79, packList<qint64>, unpackList<qint64>)
+            << makeBinaryArrayType<QList<float> >(85, packList<float>, unpackList<float>)
+            << makeBinaryArrayType<QList<double> >(86, packList<double>, unpackList<double>);
+            return types;
+        }
+        
+        const BinaryArrayType* binaryArrayTypeOf(int userType)
+        {
+            if(userType != QMetaType::QByteArray && userType < QMetaType::User)
+                return NULL;
+            for(const BinaryArrayType &type : binaryArrayTypes()) {
+                if(type.userType == userType)
+                    return &type;
+            }
+            return NULL;
+        }
+        
+        const BinaryArrayType* binaryArrayTypeNamed(const QString &typeName)
+        {
+            for(const BinaryArrayType &type : binaryArrayTypes()) {
+                if(type.typeName == typeName)
+                    return &type;
+            }
+            return NULL;
+        }
+        
+        const BinaryArrayType* binaryArrayTypeTagged(quint64 cborTag)
+        {
+            for(const BinaryArrayType &type : binaryArrayTypes()) {
+                if(cborTag && type.cborTag == cborTag)
+                    return &type;
+            }
+            return NULL;
+        }
+        
+        // Value of a {"$type": typeName, "$binary": base64} map as written to JSON.
+        // Returns false if data is not such a map.
+        bool readBinaryValue(const QVariantMap &data, QVariant &value)
+        {
+            if(data.size() != 2)
+                return false;
+            QVariantMap::const_iterator typeName = data.constFind(QStringLiteral("$type"));
+            QVariantMap::const_iterator binary = data.constFind(QStringLiteral("$binary"));
+            if(typeName == data.constEnd() || binary == data.constEnd())
+                return false;
+            const BinaryArrayType *type = binaryArrayTypeNamed(typeName.value().toString());
+            if(!type)
+                return false;
+            value = type->unpack(QByteArray::fromBase64(binary.value().toString().toLatin1()));
+            return true;
+        }
+        
+        // Convert between QVector and QList of the same element type for a property of type userType.
+        QVariant adaptBinaryArray(const QVariant &value, int userType)
+        {
+            if(value.userType() == userType || value.userType() < QMetaType::User)
+                return value;
+            const BinaryArrayType *from = binaryArrayTypeOf(value.userType());
+            const BinaryArrayType *to = from && from->cborTag ? binaryArrayTypeOf(userType) : NULL;
+            if(!to || to->cborTag != from->cborTag)
+                return value;
+            return to->unpack(from->pack(value));
+        }
+        
+        // Same as addMappedData() but without converting the key.
+        void addMappedValue(QVariantMap &data, const QString &key, const QVariant &value)
+        {
+            if(value.canConvert<QObject*>()) {
+                // Handle QObject* values. !!! This will be deserialized as a child object!
+                QObject *object = qvariant_cast<QObject*>(value);
+                addMappedValue(data, key, serialize(object));
+            } else if(value.canConvert<QList<QObject*> >()) {
+                // Handle QList<QObject*> values. !!! These will be deserialized as child objects!
+                QList<QObject*> objects = qvariant_cast<QList<QObject*> >(value);
+                QVariantList values;
+                for(QObject *object : objects) {
+                    values.append(serialize(object));
+                }
+                addMappedValue(data, key, values);
+            } else {
+                // Handle all other values (i.e. QVariant, QVariantList, QVariantMap, ...).
+                if(data.contains(key)) {
+                    // If data already contains key, make sure key's value is a list and append the input value.
+                    QVariant &existingData = data[key];
+                    QVariantList values;
+                    if(existingData.type() == QVariant::List) {
+                        values = existingData.toList();
+                        // Drop the map's reference to the list so that appending does not copy it.
+                        existingData = QVariant();
+                    } else {
+                        values.append(existingData);
+                    }
+                    values.append(value);
+                    existingData = values;
+                } else {
+                    data[key] = value;
+                }
+            }
+        }
+        
+        // Add a group of values for the same key. Same result as calling addMappedValue() for each value.
+        void addMappedValues(QVariantMap &data, const QString &key, const QVariantList &values)
+        {
+            if(values.isEmpty())
+                return;
+            if(!data.contains(key)) {
+                data.insert(key, values.size() == 1 ? values.first() : QVariant(values));
+                return;
+            }
+            // Key collision (e.g. a property with the same name as a child class).
+            for(const QVariant &value : values)
+                addMappedValue(data, key, value);
+        }
+        
+        // Add static and dynamic property values of object.
+        void addPropertyData(QVariantMap &data, const QObject *object, bool includeReadOnlyProperties, Statistics *statistics = NULL)
+        {
+            QElapsedTimer timer;
+            if(statistics)
+                timer.start();
+            const PropertyPlanPointer plan = propertyPlan(object->metaObject());
+            const QVector<int> &propertyIndexes = includeReadOnlyProperties ? plan->readableIndexes : plan->readWriteIndexes;
+            for(int index : propertyIndexes) {
+                const QVariant propertyValue = plan->read(index, object);
+                addMappedValue(data, plan->keys.at(index), propertyValue);
+            }
+            const QList<QByteArray> dynamicPropertyNames = object->dynamicPropertyNames();
+            foreach(const QByteArray &propertyName, dynamicPropertyNames) {
                 const QVariant propertyValue = object->property(propertyName.constData());
-                addMappedData(data, propertyName, propertyValue);
+                addMappedValue(data, QString::fromUtf8(propertyName), propertyValue);
+            }
+            if(statistics) {
+                statistics->readNsecs += timer.nsecsElapsed();
+                const QByteArray className = object->metaObject()->className();
+                count(statistics, className, &Statistics::Counts::objectsVisited);
+                count(statistics, className, &Statistics::Counts::propertiesRead, propertyIndexes.size() + dynamicPropertyNames.size());
+            }
+        }
+        
+        // Add serialized children grouped by class name in a single pass.
+        // Avoids rebuilding each group's list once per child for wide parents.
+        // serializeChild(QObject*) returns the child's QVariantMap.
+        template <class SerializeChild>
+        void addChildData(QVariantMap &data, const QObjectList &children, SerializeChild serializeChild)
+        {
+            // Assign each child to a class group and count the group sizes.
+            QHash<const QMetaObject*, int> groupOfMetaObject;
+            QHash<QString, int> groupOfClassName;
+            QVector<QString> groupKeys;
+            QVector<int> groupSizes;
+            QVector<int> childGroups;
+            childGroups.reserve(children.size());
+            for(QObject *child : children) {
+                const QMetaObject *metaObject = child->metaObject();
+                QHash<const QMetaObject*, int>::const_iterator it = groupOfMetaObject.constFind(metaObject);
+                int group;
+                if(it != groupOfMetaObject.constEnd()) {
+                    group = it.value();
+                } else {
+                    // Different classes may share a class name, in which case they share a group.
+                    const QString className = QString::fromUtf8(metaObject->className());
+                    group = groupOfClassName.value(className, -1);
+                    if(group == -1) {
+                        group = groupKeys.size();
+                        groupOfClassName.insert(className, group);
+                        groupKeys.append(className);
+                        groupSizes.append(0);
+                    }
+                    groupOfMetaObject.insert(metaObject, group);
+                }
+                childGroups.append(group);
+                ++groupSizes[group];
+            }
+            // Build each group's list once.
+            QVector<QVariantList> groups(groupKeys.size());
+            for(int group = 0; group < groups.size(); ++group)
+                groups[group].reserve(groupSizes.at(group));
+            for(int i = 0; i < children.size(); ++i)
+                groups[childGroups.at(i)].append(serializeChild(children.at(i)));
+            for(int group = 0; group < groups.size(); ++group)
+                addMappedValues(data, groupKeys.at(group), groups.at(group));
+        }
+        
+        // Options passed down through deserialization.
+        struct DeserializeContext
+        {
+            ObjectFactory *factory;
+            DeserializeFlags flags;
+            QList<PropertyChange> *changes;
+            Statistics *statistics;
+            // If not NULL, only selected properties and children are deserialized.
+            const Selector *selector;
+            
+            DeserializeContext(ObjectFactory *factory, DeserializeFlags flags = DeserializeFlags(), QList<PropertyChange> *changes = NULL, Statistics *statistics = NULL, const Selector *selector = NULL) :
+            factory(factory), flags(flags), changes(changes), statistics(statistics), selector(selector) {}
+        };
+        
+        // True if value would not change a property whose current value is currentValue.
+        bool isSameValue(const QVariant &currentValue, const QVariant &value)
+        {
+            if(currentValue.userType() == value.userType())
+                return currentValue == value;
+            // e.g. a QVector<int> read from CBOR for a QList<int> property.
+            const QVariant binaryArray = adaptBinaryArray(value, currentValue.userType());
+            if(binaryArray.userType() == currentValue.userType())
+                return currentValue == binaryArray;
+            // e.g. JSON numbers are doubles and dates are strings.
+            QVariant convertedValue = value;
+            return currentValue.isValid() && convertedValue.convert(currentValue.userType()) && convertedValue == currentValue;
+        }
+        
+        // Set property (static or dynamic) by map key.
+        void writeProperty(QObject *object, const PropertyPlan &plan, const QString &key, const QVariant &value, const DeserializeContext &context)
+        {
+            const int index = plan.indexOfKey.value(key, -1);
+            QByteArray propertyName;
+            if(index == -1 || context.changes)
+                propertyName = key.toUtf8();
+            QElapsedTimer timer;
+            if(context.statistics)
+                timer.start();
+            if(context.flags & SkipUnchangedProperties) {
+                const QVariant currentValue = index != -1 ? plan.read(index, object) : object->property(propertyName.constData());
+                if(isSameValue(currentValue, value)) {
+                    if(context.statistics) {
+                        context.statistics->writeNsecs += timer.nsecsElapsed();
+                        count(context.statistics, object->metaObject()->className(), &Statistics::Counts::propertiesSkipped);
+                    }
+                    return;
+                }
+            }
+            bool written = true;
+            if(index != -1) {
+                // Only NOTIFY signals are deferred, so signals are blocked just while a property that has one is written.
+                QSignalBlocker signalBlocker(object);
+                if(!(context.flags & DeferNotifications) || !plan.properties.at(index).hasNotifySignal())
+                    signalBlocker.unblock();
+                written = plan.write(index, object, adaptBinaryArray(value, plan.properties.at(index).userType()));
+            } else
+                object->setProperty(propertyName.constData(), value);
+            if(written && context.changes)
+                context.changes->append(PropertyChange(object, propertyName));
+            if(context.statistics) {
+                context.statistics->writeNsecs += timer.nsecsElapsed();
+                count(context.statistics, object->metaObject()->className(), written ? &Statistics::Counts::propertiesWritten : &Statistics::Counts::propertiesSkipped);
+            }
+        }
+        
+        /* --------------------------------------------------------------------------------
+         * Index of an object's direct children by (className, objectName).
+         * Built on first use, and children are consumed from it as they are matched
+         * so that each lookup is O(1) amortized.
+         * -------------------------------------------------------------------------------- */
+        class ChildIndex
+        {
+        public:
+            explicit ChildIndex(QObject *parent) : _parent(parent), _built(false) {}
+            
+            // First child with className and objectName (or any objectName if objectName is empty).
+            // Does NOT consume the child.
+            QObject* find(const QByteArray &className, const QString &objectName)
+            {
+                build();
+                QHash<QByteArray, ClassChildren>::const_iterator it = _classes.constFind(className);
+                if(it == _classes.constEnd())
+                    return NULL;
+                if(objectName.isEmpty())
+                    return it->all.isEmpty() ? NULL : it->all.first();
+                const QObjectList named = it->named.value(objectName);
+                return named.isEmpty() ? NULL : named.first();
+            }
+            
+            // Take the first unconsumed child with className and (non-empty) objectName.
+            QObject* takeNamed(const QByteArray &className, const QString &objectName)
+            {
+                build();
+                QHash<QByteArray, ClassChildren>::iterator it = _classes.find(className);
+                if(it == _classes.end())
+                    return NULL;
+                QHash<QString, QObjectList>::iterator named = it->named.find(objectName);
+                if(named == it->named.end() || named->isEmpty())
+                    return NULL;
+                return named->takeFirst();
+            }
+            
+            // Take the first unconsumed child with className and an empty objectName.
+            QObject* takeUnnamed(const QByteArray &className)
+            {
+                build();
+                QHash<QByteArray, ClassChildren>::iterator it = _classes.find(className);
+                if(it == _classes.end() || it->unnamed.isEmpty())
+                    return NULL;
+                return it->unnamed.takeFirst();
+            }
+            
+        private:
+            struct ClassChildren
+            {
+                QObjectList all;
+                QObjectList unnamed;
+                QHash<QString, QObjectList> named;
+            };
+            
+            void build()
+            {
+                if(_built)
+                    return;
+                _built = true;
+                foreach(QObject *child, _parent->children()) {
+                    ClassChildren &classChildren = _classes[QByteArray(child->metaObject()->className())];
+                    classChildren.all.append(child);
+                    const QString objectName = child->objectName();
+                    if(objectName.isEmpty())
+                        classChildren.unnamed.append(child);
+                    else
+                        classChildren.named[objectName].append(child);
+                }
+            }
+            
+            QObject *_parent;
+            bool _built;
+            QHash<QByteArray, ClassChildren> _classes;
+        };
+        
+        // Create a new child of parent with className (requires a factory for anything other than QObject).
+        QObject* createChild(QObject *parent, const QByteArray &className, ObjectFactory *factory)
+        {
+            QObject *child = NULL;
+            if(className == QByteArray("QObject"))
+                child = new QObject;
+            else if(factory)
+                child = factory->create(className);
+            if(child)
+                child->setParent(parent);
+            return child;
+        }
+        
+        // Create numChildren new children of parent with className at once (requires a factory for anything other than QObject).
+        QObjectList createChildren(QObject *parent, const QByteArray &className, int numChildren, const DeserializeContext &context)
+        {
+            QElapsedTimer timer;
+            if(context.statistics)
+                timer.start();
+            QObjectList children;
+            if(className == QByteArray("QObject")) {
+                children.reserve(numChildren);
+                for(int i = 0; i < numChildren; ++i) {
+                    QObject *child = new QObject;
+                    child->setParent(parent);
+                    children.append(child);
+                }
+            } else if(context.factory) {
+                children = context.factory->createN(className, numChildren, parent);
+            }
+            if(context.statistics) {
+                context.statistics->createNsecs += timer.nsecsElapsed();
+                count(context.statistics, className, &Statistics::Counts::objectsCreated, children.size());
+            }
+            return children;
+        }
+        
+        // Find the existing child matching a child entry.
+        // Entries in a list consume the children they match. objectName is NULL if the entry does not specify one.
+        QObject* findMatchingChild(ChildIndex &existingChildren, const QByteArray &className, bool inList, const QVariant *objectName, const DeserializeContext &context)
+        {
+            QElapsedTimer timer;
+            if(context.statistics)
+                timer.start();
+            QObject *child = NULL;
+            if(inList) {
+                // If objectName is specified for the child, find the first existing child with matching objectName and className.
+                if(objectName)
+                    child = existingChildren.takeNamed(className, objectName->toString());
+                // If objectName is NOT specified for the child or we could NOT find an object with the same name,
+                // find the first existing unnamed child with matching className.
+                if(!child)
+                    child = existingChildren.takeUnnamed(className);
+            } else {
+                // If objectName is specified for the child, find the first existing child with matching objectName and className.
+                // If objectName is NOT specified for the child, find the first existing child with matching className.
+                child = existingChildren.find(className, objectName ? objectName->toString() : QString());
             }
+            if(context.statistics) {
+                context.statistics->matchNsecs += timer.nsecsElapsed();
+                if(child)
+                    count(context.statistics, className, &Statistics::Counts::objectsMatched);
+            }
+            return child;
+        }
+        
+        // Find the existing child matching a child entry, or else attempt to create one dynamically.
+        QObject* matchChild(QObject *parent, ChildIndex &existingChildren, const QByteArray &className, bool inList, const QVariant *objectName, const DeserializeContext &context)
+        {
+            QObject *child = findMatchingChild(existingChildren, className, inList, objectName, context);
+            if(!child) {
+                const QObjectList children = createChildren(parent, className, 1, context);
+                if(!children.isEmpty())
+                    child = children.first();
+            }
+            return child;
+        }
+        
+        const QVariant* objectNameOf(const QVariantMap &childData)
+        {
+            QVariantMap::const_iterator objectName = childData.constFind("objectName");
+            return objectName != childData.constEnd() ? &objectName.value() : NULL;
         }
-        foreach(const QByteArray &propertyName, object->dynamicPropertyNames()) {
-            const QVariant propertyValue = object->property(propertyName.constData());
-            addMappedData(data, propertyName, propertyValue);
+    } // anonymous namespace
+    
+    void registerBindings(const QMetaObject *metaObject, const QVector<PropertyBinding> &bindings)
+    {
+        PropertyPlanCache &cache = propertyPlanCache();
+        QWriteLocker locker(&cache.lock);
+        cache.bindings[metaObject] = bindings;
+        // Plans for the class and its subclasses have to be rebuilt.
+        cache.plans.clear();
+        ++cache.generation;
+    }
+    
+    namespace
+    {
+        QVariantMap serializeObject(const QObject *object, int childDepth, bool includeReadOnlyProperties, Statistics *statistics)
+        {
+            QVariantMap data;
+            if(!object)
+                return data;
+            // Properties.
+            addPropertyData(data, object, includeReadOnlyProperties, statistics);
+            // Children.
+            if(childDepth == -1 || childDepth > 0) {
+                if(childDepth > 0)
+                    --childDepth;
+                addChildData(data, object->children(), [childDepth, includeReadOnlyProperties, statistics](QObject *child) {
+                    return serializeObject(child, childDepth, includeReadOnlyProperties, statistics);
+                });
+            }
+            return data;
         }
-        // Children.
-        if(childDepth == -1 || childDepth > 0) {
-            if(childDepth > 0)
-                --childDepth;
+    } // anonymous namespace
+    
+    QVariantMap serialize(const QObject *object, int childDepth, bool includeReadOnlyProperties, Statistics *statistics)
+    {
+        StatisticsTimer timer(statistics);
+        return serializeObject(object, childDepth, includeReadOnlyProperties, statistics);
+    }
+    
+    namespace
+    {
+        QVariantMap serializeSelected(const QObject *object, const Selector &selector, const Selector::State &state, bool includeReadOnlyProperties, Statistics *statistics)
+        {
+            QElapsedTimer timer;
+            if(statistics)
+                timer.start();
+            QVariantMap data;
+            int numPropertiesRead = 0;
+            // Properties.
+            const PropertyPlanPointer plan = propertyPlan(object->metaObject());
+            const QVector<int> &propertyIndexes = includeReadOnlyProperties ? plan->readableIndexes : plan->readWriteIndexes;
+            for(int index : propertyIndexes) {
+                const QString &key = plan->keys.at(index);
+                if(key == QLatin1String("objectName") || selector.matchesProperty(state, key)) {
+                    addMappedValue(data, key, plan->read(index, object));
+                    ++numPropertiesRead;
+                }
+            }
+            foreach(const QByteArray &propertyName, object->dynamicPropertyNames()) {
+                const QString key = QString::fromUtf8(propertyName);
+                if(selector.matchesProperty(state, key)) {
+                    addMappedValue(data, key, object->property(propertyName.constData()));
+                    ++numPropertiesRead;
+                }
+            }
+            if(statistics) {
+                statistics->readNsecs += timer.nsecsElapsed();
+                const QByteArray className = object->metaObject()->className();
+                count(statistics, className, &Statistics::Counts::objectsVisited);
+                count(statistics, className, &Statistics::Counts::propertiesRead, numPropertiesRead);
+            }
+            // Children on selected paths.
+            QObjectList selectedChildren;
+            QHash<const QObject*, QVariantMap> childData;
             foreach(QObject *child, object->children()) {
-                const QByteArray className(child->metaObject()->className());
-                addMappedData(data, className, serialize(child, childDepth, includeReadOnlyProperties));
+                const Selector::State childState = selector.childState(state, child->metaObject()->className(), child->objectName());
+                if(childState.isEmpty())
+                    continue;
+                const QVariantMap selectedData = serializeSelected(child, selector, childState, includeReadOnlyProperties, statistics);
+                if(selectedData.size() > 1 || (selectedData.size() == 1 && !selectedData.contains("objectName"))) {
+                    selectedChildren.append(child);
+                    childData.insert(child, selectedData);
+                }
             }
+            addChildData(data, selectedChildren, [&childData](QObject *child) { return childData.value(child); });
+            return data;
         }
-        return data;
+    } // anonymous namespace
+    
+    QVariantMap serialize(const QObject *object, const Selector &selector, bool includeReadOnlyProperties, Statistics *statistics)
+    {
+        if(!object || selector.isEmpty())
+            return QVariantMap();
+        StatisticsTimer timer(statistics);
+        return serializeSelected(object, selector, selector.rootState(), includeReadOnlyProperties, statistics);
     }
     
-    QVariantList serialize(const QList<QObject*> objects, int childDepth, bool includeReadOnlyProperties)
+    QVariantList serialize(const QList<QObject*> objects, int childDepth, bool includeReadOnlyProperties, Statistics *statistics)
     {
         QVariantList data;
         for(QObject *object : objects) {
-            data.append(serialize(object, childDepth, includeReadOnlyProperties));
+            data.append(serialize(object, childDepth, includeReadOnlyProperties, statistics));
         }
         return data;
     }
     
     void addMappedData(QVariantMap &data, const QByteArray &key, const QVariant &value)
     {
-        if(value.canConvert<QObject*>()) {
-            // Handle QObject* values. !!! This will be deserialized as a child object!
-            QObject *object = qvariant_cast<QObject*>(value);
-            addMappedData(data, key, serialize(object));
-        } else if(value.canConvert<QList<QObject*> >()) {
-            // Handle QList<QObject*> values. !!! These will be deserialized as child objects!
-            QList<QObject*> objects = qvariant_cast<QList<QObject*> >(value);
-            QVariantList values;
-            for(QObject *object : objects) {
-                values.append(serialize(object));
-            }
-            addMappedData(data, key, values);
-        } else {
-            // Handle all other values (i.e. QVariant, QVariantList, QVariantMap, ...).
-            if(data.contains(key)) {
-                // If data already contains key, make sure key's value is a list and append the input value.
-                QVariant &existingData = data[key];
-                if(existingData.type() == QVariant::List) {
-                    QVariantList values = existingData.toList();
-                    values.append(value);
-                    data[key] = values;
-                } else {
-                    QVariantList values;
-                    values.append(existingData);
-                    values.append(value);
-                    data[key] = values;
-                }
-            } else {
-                data[key] = value;
-            }
-        }
+        addMappedValue(data, QString::fromUtf8(key), value);
     }
     
-    void deserialize(QObject *object, const QVariantMap &data, ObjectFactory *factory)
+    namespace
     {
-        if(!object)
-            return;
-        for(QVariantMap::const_iterator i = data.constBegin(); i != data.constEnd(); ++i) {
-            if(i.value().type() == QVariant::Map) {
-                // Child object.
-                QByteArray className = i.key().toUtf8();
-                const QVariantMap &childData = i.value().toMap();
-                bool childFound = false;
-                if(childData.contains("objectName")) {
-                    // If objectName is specified for the child, find the first existing child with matching objectName and className.
-                    QObjectList children = object->findChildren<QObject*>(childData.value("objectName").toString());
-                    foreach(QObject *child, children) {
-                        if(className == QByteArray(child->metaObject()->className())) {
-                            deserialize(child, childData, factory);
-                            childFound = true;
-                            break;
-                        }
+        // Selector state of a child entry. Returns false if the entry is not selected.
+        bool selectChild(const DeserializeContext &context, const Selector::State *state, const QByteArray &className, const QVariantMap &childData, Selector::State &childState)
+        {
+            if(!context.selector)
+                return true;
+            const QVariant *objectName = objectNameOf(childData);
+            childState = context.selector->childState(*state, className, objectName ? objectName->toString() : QString());
+            return !childState.isEmpty();
+        }
+        
+        bool selectProperty(const DeserializeContext &context, const Selector::State *state, const QString &key)
+        {
+            return !context.selector || context.selector->matchesProperty(*state, key);
+        }
+        
+        // state is the object's selector state if context has a selector.
+        void deserializeObject(QObject *object, const QVariantMap &data, const DeserializeContext &context, const Selector::State *state = NULL)
+        {
+            if(context.statistics)
+                count(context.statistics, object->metaObject()->className(), &Statistics::Counts::objectsVisited);
+            const PropertyPlanPointer plan = propertyPlan(object->metaObject());
+            ChildIndex existingChildren(object);
+            for(QVariantMap::const_iterator i = data.constBegin(); i != data.constEnd(); ++i) {
+                if(i.value().type() == QVariant::Map) {
+                    // Child object.
+                    QByteArray className = i.key().toUtf8();
+                    const QVariantMap &childData = i.value().toMap();
+                    QVariant binaryValue;
+                    if(readBinaryValue(childData, binaryValue)) {
+                        // Property.
+                        if(selectProperty(context, state, i.key()))
+                            writeProperty(object, *plan, i.key(), binaryValue, context);
+                        continue;
                     }
-                } else {
-                    // If objectName is NOT specified for the child, find the first existing child with matching className.
-                    foreach(QObject *child, object->children()) {
-                        if(className == QByteArray(child->metaObject()->className())) {
-                            deserialize(child, childData, factory);
-                            childFound = true;
-                            break;
+                    Selector::State childState;
+                    if(!selectChild(context, state, className, childData, childState))
+                        continue;
+                    QObject *child = matchChild(object, existingChildren, className, false, objectNameOf(childData), context);
+                    if(child)
+                        deserializeObject(child, childData, context, &childState);
+                } else if(i.value().type() == QVariant::List) {
+                    // List of child objects and/or properties.
+                    QByteArray className = i.key().toUtf8();
+                    const QVariantList &childDataList = i.value().toList();
+                    // Match existing children first, then create all of the missing children at once.
+                    QVector<QObject*> children(childDataList.size(), NULL);
+                    QVector<Selector::State> childStates(context.selector ? childDataList.size() : 0);
+                    int numMissingChildren = 0;
+                    for(int j = 0; j < childDataList.size(); ++j) {
+                        if(childDataList.at(j).type() == QVariant::Map) {
+                            // Child object.
+                            const QVariantMap childData = childDataList.at(j).toMap();
+                            if(context.selector && !selectChild(context, state, className, childData, childStates[j]))
+                                continue;
+                            children[j] = findMatchingChild(existingChildren, className, true, objectNameOf(childData), context);
+                            if(!children.at(j))
+                                ++numMissingChildren;
+                        } else if(selectProperty(context, state, i.key())) {
+                            // Property.
+                            const QVariant &propertyValue = childDataList.at(j);
+                            writeProperty(object, *plan, i.key(), propertyValue, context);
                         }
                     }
-                }
-                // If we still have not found an existing child, attempt to create one dynamically.
-                if(!childFound) {
-                    QObject *child = NULL;
-                    if(className == QByteArray("QObject"))
-                        child = new QObject;
-                    else if(factory && factory->hasCreator(className))
-                        child = factory->create(className);
-                    if(child) {
-                        child->setParent(object);
-                        deserialize(child, childData, factory);
-                    }
-                }
-            } else if(i.value().type() == QVariant::List) {
-                // List of child objects and/or properties.
-                QByteArray className = i.key().toUtf8();
-                const QVariantList &childDataList = i.value().toList();
-                // Keep track of existing children that have been deserialized.
-                QObjectList existingChildrenWithClassNameAndObjectName;
-                QObjectList existingChildrenWithClassName;
-                foreach(QObject *child, object->children()) {
-                    if(className == QByteArray(child->metaObject()->className())) {
-                        if(!child->objectName().isEmpty())
-                            existingChildrenWithClassNameAndObjectName.append(child);
-                        else
-                            existingChildrenWithClassName.append(child);
-                    }
-                }
-                for(QVariantList::const_iterator j = childDataList.constBegin(); j != childDataList.constEnd(); ++j) {
-                    if(j->type() == QVariant::Map) {
-                        // Child object.
-                        const QVariantMap &childData = j->toMap();
-                        bool childFound = false;
-                        if(childData.contains("objectName")) {
-                            // If objectName is specified for the child, find the first existing child with matching objectName and className.
-                            foreach(QObject *child, existingChildrenWithClassNameAndObjectName) {
-                                if(child->objectName() == childData.value("objectName").toString()) {
-                                    deserialize(child, childData, factory);
-                                    existingChildrenWithClassNameAndObjectName.removeOne(child);
-                                    childFound = true;
-                                    break;
-                                }
-                            }
-                        }
-                        if(!childFound) {
-                            // If objectName is NOT specified for the child or we could NOT find an object with the same name,
-                            // find the first existing child with matching className.
-                            if(!existingChildrenWithClassName.isEmpty()) {
-                                QObject *child = existingChildrenWithClassName.first();
-                                deserialize(child, childData, factory);
-                                existingChildrenWithClassName.removeOne(child);
-                                childFound = true;
-                            }
-                        }
-                        // If we still havent found an existing child, attempt to create one dynamically.
-                        if(!childFound) {
-                            QObject *child = NULL;
-                            if(className == QByteArray("QObject"))
-                                child = new QObject;
-                            else if(factory && factory->hasCreator(className))
-                                child = factory->create(className);
-                            if(child) {
-                                child->setParent(object);
-                                deserialize(child, childData, factory);
-                            }
+                    if(numMissingChildren) {
+                        const QObjectList newChildren = createChildren(object, className, numMissingChildren, context);
+                        for(int j = 0, k = 0; j < children.size() && k < newChildren.size(); ++j) {
+                            if(!children.at(j) && childDataList.at(j).type() == QVariant::Map && (!context.selector || !childStates.at(j).isEmpty()))
+                                children[j] = newChildren.at(k++);
                         }
-                    } else {
-                        // Property.
-                        const QByteArray &propertyName = className;
-                        const QVariant &propertyValue = *j;
-                        object->setProperty(propertyName.constData(), propertyValue);
                     }
+                    for(int j = 0; j < children.size(); ++j) {
+                        if(children.at(j))
+                            deserializeObject(children.at(j), childDataList.at(j).toMap(), context, context.selector ? &childStates.at(j) : NULL);
+                    }
+                } else if(selectProperty(context, state, i.key())) {
+                    // Property.
+                    const QVariant &propertyValue = i.value();
+                    writeProperty(object, *plan, i.key(), propertyValue, context);
                 }
-            } else {
-                // Property.
-                const QByteArray propertyName = i.key().toUtf8();
-                const QVariant &propertyValue = i.value();
-                object->setProperty(propertyName.constData(), propertyValue);
+            }
+        }
+    } // anonymous namespace
+    
+    void deserialize(QObject *object, const QVariantMap &data, ObjectFactory *factory, DeserializeFlags flags, QList<PropertyChange> *changes, Statistics *statistics)
+    {
+        if(!object)
+            return;
+        StatisticsTimer timer(statistics);
+        deserializeObject(object, data, DeserializeContext(factory, flags, changes, statistics));
+    }
+    
+    void deserialize(QObject *object, const QVariantMap &data, const Selector &selector, ObjectFactory *factory, DeserializeFlags flags, QList<PropertyChange> *changes, Statistics *statistics)
+    {
+        if(!object || selector.isEmpty())
+            return;
+        StatisticsTimer timer(statistics);
+        const Selector::State state = selector.rootState();
+        deserializeObject(object, data, DeserializeContext(factory, flags, changes, statistics, &selector), &state);
+    }
+    
+    void notifyChanges(const QList<PropertyChange> &changes)
+    {
+        QSet<QPair<QObject*, QByteArray> > notified;
+        for(const PropertyChange &change : changes) {
+            QObject *object = change.object;
+            if(!object)
+                continue;
+            const QPair<QObject*, QByteArray> objectProperty(object, change.propertyName);
+            if(notified.contains(objectProperty))
+                continue;
+            notified.insert(objectProperty);
+            const QMetaObject *metaObject = object->metaObject();
+            const int index = metaObject->indexOfProperty(change.propertyName.constData());
+            if(index == -1)
+                continue; // Dynamic property change events are not deferred.
+            const QMetaProperty metaProperty = metaObject->property(index);
+            if(!metaProperty.hasNotifySignal())
+                continue;
+            const QMetaMethod signal = metaProperty.notifySignal();
+            if(signal.parameterCount() == 0) {
+                signal.invoke(object, Qt::DirectConnection);
+            } else if(signal.parameterCount() == 1) {
+                // Signal with the new value.
+                const QVariant value = metaProperty.read(object);
+                signal.invoke(object, Qt::DirectConnection, QGenericArgument(value.typeName(), value.constData()));
             }
         }
     }
     
-    void deserialize(QList<QObject*> &objects, const QVariantList &data, ObjectFactory *factory, const QByteArray &objectCreatorKey)
+    void deserialize(QList<QObject*> &objects, const QVariantList &data, ObjectFactory *factory, const QByteArray &objectCreatorKey, Statistics *statistics)
     {
         int i = 0;
         for(QVariantList::const_iterator j = data.constBegin(); j != data.constEnd(); ++j) {
@@ -223,7 +959,7 @@ namespace QtPropertySerializer
                     }
                 }
                 if(object) {
-                    deserialize(object, j->toMap(), factory);
+                    deserialize(object, j->toMap(), factory, NoDeserializeFlags, NULL, statistics);
                     if(i < objects.size()) {
                         objects[i] = object;
                     } else {
@@ -242,36 +978,3619 @@ namespace QtPropertySerializer
         }
     }
     
-    QVariantMap readJson(const QString &filePath)
-    {
-        QFile file(filePath);
-        if(!file.open(QIODevice::Text | QIODevice::ReadOnly))
-            throw std::runtime_error("QtPropertySerializer::readJson: Failed to open file " + filePath.toStdString());
-        QString buffer = file.readAll();
-        file.close();
-        return QJsonDocument::fromJson(buffer.toUtf8()).toVariant().toMap();
-    }
-    
-    void writeJson(const QVariantMap &data, const QString &filePath)
-    {
-        QFile file(filePath);
-        if(!file.open(QIODevice::Text | QIODevice::WriteOnly))
-            throw std::runtime_error("QtPropertySerializer::writeJson: Failed to open file " + filePath.toStdString());
-        QTextStream out(&file);
-        out << QJsonDocument::fromVariant(data).toJson(QJsonDocument::Indented);
-        file.close();
-    }
-    
-    void readJson(QObject *object, const QString &filePath, ObjectFactory *factory)
+    namespace
     {
-        QVariantMap data = readJson(filePath);
-        deserialize(object, data, factory);
-    }
+        /* --------------------------------------------------------------------------------
+         * Mapped items of an object.
+         * Same keys and values as serialize(object), except that child objects are left
+         * unserialized so that encoders can stream them one at a time.
+         * -------------------------------------------------------------------------------- */
+        struct MappedItem
+        {
+            enum Kind { Value, Object, ObjectList, Bound };
+            Kind kind;
+            QVariant value; // Value, or QList<QObject*> for ObjectList.
+            const QObject *object;
+            int childDepth;
+            bool includeReadOnlyProperties;
+            // For Bound items, the binding to read object's property through.
+            const PropertyBinding *binding;
+            
+            MappedItem() : kind(Value), object(NULL), childDepth(-1), includeReadOnlyProperties(true), binding(NULL) {}
+            
+            // Items are merged into a list when they share a key, and a leading list is extended rather than nested (see addMappedData()).
+            bool isList() const { return kind == ObjectList || (kind == Value && value.type() == QVariant::List); }
+            int listSize() const { return kind == ObjectList ? qvariant_cast<QList<QObject*> >(value).size() : value.toList().size(); }
+        };
+        
+        typedef QMap<QString, QVector<MappedItem> > MappedItems;
+        
+        MappedItem mappedValue(const QVariant &value)
+        {
+            MappedItem item;
+            if(value.canConvert<QObject*>()) {
+                // Handle QObject* values. !!! This will be deserialized as a child object!
+                item.kind = MappedItem::Object;
+                item.object = qvariant_cast<QObject*>(value);
+            } else if(value.canConvert<QList<QObject*> >()) {
+                // Handle QList<QObject*> values. !!! These will be deserialized as child objects!
+                item.kind = MappedItem::ObjectList;
+                item.value = value;
+            } else {
+                item.value = value;
+            }
+            return item;
+        }
+        
+        // Returns the object's property plan, which must outlive the items (Bound items refer to its bindings).
+        PropertyPlanPointer collectMappedItems(const QObject *object, int childDepth, bool includeReadOnlyProperties, MappedItems &items, Statistics *statistics = NULL)
+        {
+            if(!object)
+                return PropertyPlanPointer();
+            // Properties.
+            QElapsedTimer timer;
+            if(statistics)
+                timer.start();
+            const PropertyPlanPointer plan = propertyPlan(object->metaObject());
+            const QVector<int> &propertyIndexes = includeReadOnlyProperties ? plan->readableIndexes : plan->readWriteIndexes;
+            for(int index : propertyIndexes) {
+                const PropertyBinding &binding = plan->bindings.at(index);
+                if(binding.read && binding.type != BoundValue::Variant) {
+                    // Read when written, without a QVariant.
+                    MappedItem item;
+                    item.kind = MappedItem::Bound;
+                    item.object = object;
+                    item.binding = &binding;
+                    items[plan->keys.at(index)].append(item);
+                } else {
+                    items[plan->keys.at(index)].append(mappedValue(plan->read(index, object)));
+                }
+            }
+            const QList<QByteArray> dynamicPropertyNames = object->dynamicPropertyNames();
+            foreach(const QByteArray &propertyName, dynamicPropertyNames)
+                items[QString::fromUtf8(propertyName)].append(mappedValue(object->property(propertyName.constData())));
+            if(statistics) {
+                statistics->readNsecs += timer.nsecsElapsed();
+                const QByteArray className = object->metaObject()->className();
+                count(statistics, className, &Statistics::Counts::objectsVisited);
+                count(statistics, className, &Statistics::Counts::propertiesRead, propertyIndexes.size() + dynamicPropertyNames.size());
+            }
+            // Children.
+            if(childDepth == -1 || childDepth > 0) {
+                if(childDepth > 0)
+                    --childDepth;
+                QHash<const QMetaObject*, QVector<MappedItem>*> groups;
+                foreach(QObject *child, object->children()) {
+                    QVector<MappedItem> *&group = groups[child->metaObject()];
+                    if(!group)
+                        group = &items[QString::fromUtf8(child->metaObject()->className())];
+                    MappedItem item;
+                    item.kind = MappedItem::Object;
+                    item.object = child;
+                    item.childDepth = childDepth;
+                    item.includeReadOnlyProperties = includeReadOnlyProperties;
+                    group->append(item);
+                }
+            }
+            return plan;
+        }
+        
+        /* --------------------------------------------------------------------------------
+         * Streaming encoder interface.
+         * Walks QObject trees or QVariant data once and emits tokens to a format specific writer.
+         * -------------------------------------------------------------------------------- */
+        class Encoder
+        {
+        public:
+            Encoder() : _statistics(NULL) {}
+            virtual ~Encoder() {}
+            
+            // Collect statistics for writeObject().
+            void setStatistics(Statistics *statistics) { _statistics = statistics; }
+            
+            virtual void beginMap(int size) = 0;
+            virtual void key(const QString &key) = 0;
+            virtual void endMap() = 0;
+            virtual void beginArray(int size) = 0;
+            virtual void endArray() = 0;
+            // Any value other than a QVariantMap or QVariantList.
+            virtual void value(const QVariant &value) = 0;
+            // Value read through a typed binding. Encoders can override this to avoid boxing it in a QVariant.
+            virtual void boundValue(const BoundValue &value) { this->value(value.toVariant()); }
+            
+            void writeVariant(const QVariant &value)
+            {
+                if(value.type() == QVariant::Map) {
+                    writeMap(value.toMap());
+                } else if(value.type() == QVariant::List) {
+                    const QVariantList values = value.toList();
+                    beginArray(values.size());
+                    for(const QVariant &element : values)
+                        writeVariant(element);
+                    endArray();
+                } else {
+                    this->value(value);
+                }
+            }
+            
+            void writeMap(const QVariantMap &data)
+            {
+                beginMap(data.size());
+                // objectName goes first so that streaming readers can match existing children as soon as they see them.
+                QVariantMap::const_iterator objectName = data.constFind("objectName");
+                if(objectName != data.constEnd()) {
+                    key(objectName.key());
+                    writeVariant(objectName.value());
+                }
+                for(QVariantMap::const_iterator i = data.constBegin(); i != data.constEnd(); ++i) {
+                    if(i != objectName) {
+                        key(i.key());
+                        writeVariant(i.value());
+                    }
+                }
+                endMap();
+            }
+            
+            void writeObject(const QObject *object, int childDepth, bool includeReadOnlyProperties)
+            {
+                MappedItems items;
+                const PropertyPlanPointer plan = collectMappedItems(object, childDepth, includeReadOnlyProperties, items, _statistics);
+                beginMap(items.size());
+                // objectName goes first so that streaming readers can match existing children as soon as they see them.
+                MappedItems::const_iterator objectName = items.constFind("objectName");
+                if(objectName != items.constEnd()) {
+                    key(objectName.key());
+                    writeItems(objectName.value());
+                }
+                for(MappedItems::const_iterator i = items.constBegin(); i != items.constEnd(); ++i) {
+                    if(i != objectName) {
+                        key(i.key());
+                        writeItems(i.value());
+                    }
+                }
+                endMap();
+            }
+            
+        private:
+            void writeItem(const MappedItem &item, bool inlineList = false)
+            {
+                if(item.kind == MappedItem::Object) {
+                    writeObject(item.object, item.childDepth, item.includeReadOnlyProperties);
+                } else if(item.kind == MappedItem::Bound) {
+                    BoundValue value;
+                    item.binding->read(item.object, value);
+                    boundValue(value);
+                } else if(item.kind == MappedItem::ObjectList) {
+                    const QList<QObject*> objects = qvariant_cast<QList<QObject*> >(item.value);
+                    if(!inlineList)
+                        beginArray(objects.size());
+                    for(QObject *object : objects)
+                        writeObject(object, -1, true);
+                    if(!inlineList)
+                        endArray();
+                } else if(inlineList) {
+                    for(const QVariant &element : item.value.toList())
+                        writeVariant(element);
+                } else {
+                    writeVariant(item.value);
+                }
+            }
+            
+            void writeItems(const QVector<MappedItem> &items)
+            {
+                if(items.size() == 1) {
+                    writeItem(items.first());
+                    return;
+                }
+                // Multiple items under the same key are merged into a list (see addMappedData()).
+                const bool extendFirst = items.first().isList();
+                beginArray(items.size() - 1 + (extendFirst ? items.first().listSize() : 1));
+                writeItem(items.first(), extendFirst);
+                for(int i = 1; i < items.size(); ++i)
+                    writeItem(items.at(i));
+                endArray();
+            }
+            
+            Statistics *_statistics;
+        };
+        
+        /* --------------------------------------------------------------------------------
+         * Streaming JSON encoder.
+         * Output is buffered and written to the device in bounded chunks.
+         * -------------------------------------------------------------------------------- */
+        class JsonEncoder : public Encoder
+        {
+        public:
+            // indentLevel is the nesting level of a value that is encoded separately (see raw()).
+            JsonEncoder(QIODevice *device, QJsonDocument::JsonFormat format, int indentLevel = 0) :
+            _device(device), _indented(format == QJsonDocument::Indented), _afterKey(false), _indentLevel(indentLevel)
+            {
+                if(!_device || !_device->isWritable())
+                    throw std::runtime_error("QtPropertySerializer::writeJson: Device is not open for writing");
+                _buffer.reserve(BufferSize + BufferSize / 4);
+            }
+            
+            void beginMap(int) override { beginValue(); _buffer += '{'; _counts.append(0); }
+            void endMap() override { endContainer('}'); }
+            void beginArray(int) override { beginValue(); _buffer += '['; _counts.append(0); }
+            void endArray() override { endContainer(']'); }
+            
+            void key(const QString &key) override
+            {
+                nextElement();
+                writeString(key);
+                _buffer += _indented ? ": " : ":";
+                _afterKey = true;
+            }
+            
+            void value(const QVariant &value) override
+            {
+                if(const BinaryArrayType *type = binaryArrayTypeOf(value.userType()))
+                    writeBinary(*type, value);
+                else
+                    writeJsonValue(QJsonValue::fromVariant(value));
+            }
+            
+            void boundValue(const BoundValue &value) override
+            {
+                switch(value.type) {
+                    case BoundValue::Bool:
+                        beginValue();
+                        _buffer += value.boolValue ? "true" : "false";
+                        break;
+                    case BoundValue::Int:
+                        beginValue();
+                        _buffer += QByteArray::number(value.intValue);
+                        break;
+                    case BoundValue::LongLong:
+                        // JSON numbers are doubles (same as QJsonValue).
+                        beginValue();
+                        writeNumber(double(value.longLongValue));
+                        break;
+                    case BoundValue::Double:
+                        beginValue();
+                        writeNumber(value.doubleValue);
+                        break;
+                    case BoundValue::String:
+                        beginValue();
+                        writeString(value.stringValue);
+                        break;
+                    default:
+                        this->value(value.variantValue);
+                }
+            }
+            
+            // Value that is already encoded (e.g. by another encoder with the same format and this encoder's indentation level).
+            void raw(const QByteArray &json)
+            {
+                beginValue();
+                flush();
+                write(json.constData(), json.size());
+            }
+            
+            // Flush everything to the device. Must be called once the document is complete.
+            void finish()
+            {
+                if(_indented)
+                    _buffer += '\n';
+                flush();
+            }
+            
+            // Same as finish() for a value that is encoded separately.
+            void finishValue() { flush(); }
+            
+        private:
+            static const int BufferSize = 64 * 1024;
+            
+            void flush()
+            {
+                write(_buffer.constData(), _buffer.size());
+                _buffer.resize(0);
+            }
+            
+            void write(const char *data, qint64 remaining)
+            {
+                while(remaining > 0) {
+                    const qint64 written = _device->write(data, remaining);
+                    if(written <= 0)
+                        throw std::runtime_error("QtPropertySerializer::writeJson: Failed to write to device: " + _device->errorString().toStdString());
+                    data += written;
+                    remaining -= written;
+                }
+            }
+            
+            void newline()
+            {
+                if(_indented) {
+                    _buffer += '\n';
+                    _buffer.append(QByteArray(4 * (_indentLevel + _counts.size()), ' '));
+                }
+            }
+            
+            // Separator and indentation for the next element of the current container.
+            void nextElement()
+            {
+                if(_buffer.size() >= BufferSize)
+                    flush();
+                if(_counts.isEmpty())
+                    return;
+                int &count = _counts.last();
+                if(count)
+                    _buffer += ',';
+                ++count;
+                newline();
+            }
+            
+            void beginValue()
+            {
+                if(_afterKey)
+                    _afterKey = false;
+                else
+                    nextElement();
+            }
+            
+            void endContainer(char bracket)
+            {
+                const int count = _counts.takeLast();
+                if(count)
+                    newline();
+                _buffer += bracket;
+            }
+            
+            void writeString(const QString &string)
+            {
+                static const char hex[] = "0123456789abcdef";
+                const QByteArray utf8 = string.toUtf8();
+                _buffer += '"';
+                const char *run = utf8.constData();
+                const char *end = run + utf8.size();
+                for(const char *c = run; c != end; ++c) {
+                    const uchar u = uchar(*c);
+                    if(u >= 0x20 && u != '"' && u != '\\')
+                        continue;
+                    _buffer.append(run, int(c - run));
+                    run = c + 1;
+                    switch(u) {
+                        case '"': _buffer += "\\\""; break;
+                        case '\\': _buffer += "\\\\"; break;
+                        case '\b': _buffer += "\\b"; break;
+                        case '\f': _buffer += "\\f"; break;
+                        case '\n': _buffer += "\\n"; break;
+                        case '\r': _buffer += "\\r"; break;
+                        case '\t': _buffer += "\\t"; break;
+                        default:
+                            _buffer += "\\u00";
+                            _buffer += hex[u >> 4];
+                            _buffer += hex[u & 0xf];
+                    }
+                }
+                _buffer.append(run, int(end - run));
+                _buffer += '"';
+            }
+            
+            // {"$type": typeName, "$binary": base64}
+            void writeBinary(const BinaryArrayType &type, const QVariant &value)
+            {
+                beginMap(2);
+                key(QStringLiteral("$type"));
+                beginValue();
+                writeString(type.typeName);
+                key(QStringLiteral("$binary"));
+                beginValue();
+                _buffer += '"';
+                _buffer += type.pack(value).toBase64();
+                _buffer += '"';
+                endMap();
+            }
+            
+            void writeNumber(double number)
+            {
+                if(!qIsFinite(number))
+                    _buffer += "null";
+                else if(number == std::floor(number) && qAbs(number) < 1e15)
+                    _buffer += QByteArray::number(qint64(number));
+                else
+                    _buffer += QByteArray::number(number, 'g', QLocale::FloatingPointShortest);
+            }
+            
+            void writeJsonValue(const QJsonValue &value)
+            {
+                switch(value.type()) {
+                    case QJsonValue::Array: {
+                        const QJsonArray array = value.toArray();
+                        beginArray(array.size());
+                        for(const QJsonValue &element : array)
+                            writeJsonValue(element);
+                        endArray();
+                        break;
+                    }
+                    case QJsonValue::Object: {
+                        const QJsonObject object = value.toObject();
+                        beginMap(object.size());
+                        for(QJsonObject::const_iterator i = object.constBegin(); i != object.constEnd(); ++i) {
+                            key(i.key());
+                            writeJsonValue(i.value());
+                        }
+                        endMap();
+                        break;
+                    }
+                    case QJsonValue::Bool:
+                        beginValue();
+                        _buffer += value.toBool() ? "true" : "false";
+                        break;
+                    case QJsonValue::Double:
+                        beginValue();
+                        writeNumber(value.toDouble());
+                        break;
+                    case QJsonValue::String:
+                        beginValue();
+                        writeString(value.toString());
+                        break;
+                    default:
+                        beginValue();
+                        _buffer += "null";
+                }
+            }
+            
+            QIODevice *_device;
+            bool _indented;
+            bool _afterKey;
+            int _indentLevel;
+            QByteArray _buffer;
+            // Number of elements written so far in each open container.
+            QVector<int> _counts;
+        };
+    } // anonymous namespace
     
-    void writeJson(QObject *object, const QString &filePath, int childDepth, bool includeReadOnlyProperties)
+    namespace
     {
-        QVariantMap data = serialize(object, childDepth, includeReadOnlyProperties);
-        writeJson(data, filePath);
+        /* --------------------------------------------------------------------------------
+         * Streaming decoder interface.
+         * Pulls tokens one at a time from a format specific reader.
+         * -------------------------------------------------------------------------------- */
+        struct Token
+        {
+            enum Type { BeginMap, EndMap, BeginArray, EndArray, Key, Value, End };
+            Type type;
+            QString key; // For Key tokens.
+            QVariant value; // For Value tokens.
+        };
+        
+        class Decoder
+        {
+        public:
+            virtual ~Decoder() {}
+            
+            // Throws std::runtime_error for malformed input.
+            virtual void next(Token &token) = 0;
+            
+            // Input offset just after the last token, or -1 if unknown.
+            virtual qint64 offset() const { return -1; }
+            
+            // Start recording the input from offset begin, which must not be before the last token.
+            // Returns false if the decoder cannot record its input.
+            virtual bool beginCapture(qint64 begin) { Q_UNUSED(begin); return false; }
+            // Stop recording and return the input from the beginCapture() offset up to offset().
+            virtual QByteArray endCapture() { return QByteArray(); }
+            
+            // Read the rest of a map or array after its Begin token.
+            QVariant readContainer(const Token &begin)
+            {
+                Token token;
+                if(begin.type == Token::BeginMap) {
+                    QVariantMap data;
+                    readMapEntries(data);
+                    QVariant binaryValue;
+                    return readBinaryValue(data, binaryValue) ? binaryValue : QVariant(data);
+                }
+                QVariantList values;
+                for(next(token); token.type != Token::EndArray; next(token))
+                    values.append(readValue(token));
+                return values;
+            }
+            
+            // Read a complete value starting with token.
+            QVariant readValue(const Token &token)
+            {
+                if(token.type == Token::BeginMap || token.type == Token::BeginArray)
+                    return readContainer(token);
+                if(token.type != Token::Value)
+                    throw std::runtime_error("QtPropertySerializer: Unexpected token");
+                return token.value;
+            }
+            
+            // Read the remaining entries of a map into data.
+            void readMapEntries(QVariantMap &data)
+            {
+                Token token;
+                for(next(token); token.type != Token::EndMap; next(token)) {
+                    const QString key = token.key;
+                    next(token);
+                    data.insert(key, readValue(token));
+                }
+            }
+            
+            // Skip the rest of a map or array after its Begin token.
+            virtual void skipContainer()
+            {
+                Token token;
+                int depth = 1;
+                while(depth) {
+                    next(token);
+                    if(token.type == Token::BeginMap || token.type == Token::BeginArray)
+                        ++depth;
+                    else if(token.type == Token::EndMap || token.type == Token::EndArray)
+                        --depth;
+                    else if(token.type == Token::End)
+                        throw std::runtime_error("QtPropertySerializer: Unexpected end of data");
+                }
+            }
+        };
+        
+        /* --------------------------------------------------------------------------------
+         * Streaming JSON decoder.
+         * Reads the device in bounded chunks, or decodes data that is already in memory.
+         * -------------------------------------------------------------------------------- */
+        class JsonDecoder : public Decoder
+        {
+        public:
+            explicit JsonDecoder(QIODevice *device) : _device(device), _pos(0), _offset(0), _state(BeforeValue), _capturePos(-1)
+            {
+                if(!_device || !_device->isReadable())
+                    throw std::runtime_error("QtPropertySerializer::readJson: Device is not open for reading");
+            }
+            
+            // data is not copied (e.g. QByteArray::fromRawData() of a mapped file).
+            explicit JsonDecoder(const QByteArray &data) : _device(NULL), _buffer(data), _pos(0), _offset(0), _state(BeforeValue), _capturePos(-1) {}
+            
+            qint64 offset() const override { return _offset + _pos; }
+            
+            bool beginCapture(qint64 begin) override
+            {
+                if(begin < _offset || begin > _offset + _pos)
+                    return false;
+                _capture.clear();
+                _capturePos = int(begin - _offset);
+                return true;
+            }
+            
+            // Data that is already in memory is not copied.
+            QByteArray endCapture() override
+            {
+                if(_capturePos < 0)
+                    return QByteArray();
+                QByteArray data;
+                if(_capture.isEmpty() && !_device) {
+                    data = QByteArray::fromRawData(_buffer.constData() + _capturePos, _pos - _capturePos);
+                } else {
+                    _capture.append(_buffer.constData() + _capturePos, _pos - _capturePos);
+                    data.swap(_capture);
+                }
+                _capturePos = -1;
+                return data;
+            }
+            
+            // Scan for the matching closing bracket without decoding anything.
+            // Only checks that brackets outside of strings balance.
+            void skipContainer() override
+            {
+                int depth = 1;
+                bool inString = false;
+                bool escaped = false;
+                while(depth) {
+                    if(!fill())
+                        error("Unexpected end of data");
+                    const char *data = _buffer.constData();
+                    const int size = _buffer.size();
+                    while(_pos < size && depth) {
+                        const char c = data[_pos++];
+                        if(escaped)
+                            escaped = false;
+                        else if(inString && c == '\\')
+                            escaped = true;
+                        else if(inString)
+                            inString = c != '"';
+                        else if(c == '"')
+                            inString = true;
+                        else if(c == '{' || c == '[')
+                            ++depth;
+                        else if(c == '}' || c == ']')
+                            --depth;
+                    }
+                }
+                _containers.removeLast();
+                _state = AfterValue;
+            }
+            
+            void next(Token &token) override
+            {
+                skipWhitespace();
+                switch(_state) {
+                    case AfterValue: {
+                        if(_containers.isEmpty()) {
+                            if(!atEnd())
+                                error("Unexpected data after document");
+                            token.type = Token::End;
+                            return;
+                        }
+                        const char c = get();
+                        const bool inMap = _containers.last() == '{';
+                        if(c == ',') {
+                            _state = inMap ? BeforeKey : BeforeValue;
+                            next(token);
+                            return;
+                        }
+                        if(c != (inMap ? '}' : ']'))
+                            error("Expected ',' or closing bracket");
+                        endContainer(token);
+                        return;
+                    }
+                    case BeforeKeyOrEnd:
+                        if(peek() == '}') {
+                            get();
+                            endContainer(token);
+                            return;
+                        }
+                        // Fall through.
+                    case BeforeKey:
+                        if(get() != '"')
+                            error("Expected string key");
+                        token.type = Token::Key;
+                        token.key = readString();
+                        skipWhitespace();
+                        if(get() != ':')
+                            error("Expected ':'");
+                        _state = BeforeValue;
+                        return;
+                    case BeforeValueOrEnd:
+                        if(peek() == ']') {
+                            get();
+                            endContainer(token);
+                            return;
+                        }
+                        // Fall through.
+                    case BeforeValue:
+                        readValueToken(token);
+                        return;
+                }
+            }
+            
+        protected:
+            enum State { BeforeValue, BeforeValueOrEnd, BeforeKey, BeforeKeyOrEnd, AfterValue };
+            static const int ChunkSize = 64 * 1024;
+            
+            void error(const char *message) const
+            {
+                throw std::runtime_error(std::string("QtPropertySerializer::readJson: ") + message + " at offset " + QByteArray::number(_offset + _pos).toStdString());
+            }
+            
+            // Read the next chunk if the current one is used up. Returns false at the end of the data.
+            bool fill()
+            {
+                if(_pos < _buffer.size())
+                    return true;
+                if(!_device)
+                    return false;
+                if(_capturePos >= 0) {
+                    _capture.append(_buffer.constData() + _capturePos, _buffer.size() - _capturePos);
+                    _capturePos = 0;
+                }
+                _offset += _buffer.size();
+                _pos = 0;
+                _buffer = _device->read(ChunkSize);
+                if(_buffer.isEmpty() && _device->isSequential() && _device->waitForReadyRead(-1))
+                    _buffer = _device->read(ChunkSize);
+                return !_buffer.isEmpty();
+            }
+            
+            bool atEnd() { return !fill(); }
+            char peek() { if(!fill()) error("Unexpected end of data"); return _buffer.at(_pos); }
+            char get() { const char c = peek(); ++_pos; return c; }
+            
+            void skipWhitespace()
+            {
+                while(fill()) {
+                    const char c = _buffer.at(_pos);
+                    if(c != ' ' && c != '\n' && c != '\r' && c != '\t')
+                        return;
+                    ++_pos;
+                }
+            }
+            
+            void endContainer(Token &token)
+            {
+                token.type = _containers.takeLast() == '{' ? Token::EndMap : Token::EndArray;
+                _state = AfterValue;
+            }
+            
+            void readValueToken(Token &token)
+            {
+                const char c = peek();
+                if(c == '{' || c == '[') {
+                    get();
+                    _containers.append(c);
+                    token.type = c == '{' ? Token::BeginMap : Token::BeginArray;
+                    _state = c == '{' ? BeforeKeyOrEnd : BeforeValueOrEnd;
+                    return;
+                }
+                token.type = Token::Value;
+                if(c == '"') {
+                    get();
+                    token.value = readString();
+                } else if(c == '-' || (c >= '0' && c <= '9')) {
+                    token.value = readNumber();
+                } else if(c == 't') {
+                    readLiteral("true");
+                    token.value = true;
+                } else if(c == 'f') {
+                    readLiteral("false");
+                    token.value = false;
+                } else if(c == 'n') {
+                    readLiteral("null");
+                    token.value = QVariant();
+                } else {
+                    error("Unexpected character");
+                }
+                _state = AfterValue;
+            }
+            
+            void readLiteral(const char *literal)
+            {
+                for(const char *c = literal; *c; ++c) {
+                    if(get() != *c)
+                        error("Invalid literal");
+                }
+            }
+            
+            QVariant readNumber()
+            {
+                QByteArray number;
+                while(fill()) {
+                    const char c = _buffer.at(_pos);
+                    if(!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'))
+                        break;
+                    number += c;
+                    ++_pos;
+                }
+                bool ok = false;
+                const double value = number.toDouble(&ok);
+                if(!ok)
+                    error("Invalid number");
+                return value;
+            }
+            
+            uint readHex4()
+            {
+                uint value = 0;
+                for(int i = 0; i < 4; ++i) {
+                    const char c = get();
+                    value <<= 4;
+                    if(c >= '0' && c <= '9')
+                        value |= uint(c - '0');
+                    else if(c >= 'a' && c <= 'f')
+                        value |= uint(c - 'a' + 10);
+                    else if(c >= 'A' && c <= 'F')
+                        value |= uint(c - 'A' + 10);
+                    else
+                        error("Invalid unicode escape");
+                }
+                return value;
+            }
+            
+            static void appendUtf8(QByteArray &utf8, uint codePoint)
+            {
+                if(codePoint < 0x80) {
+                    utf8 += char(codePoint);
+                } else if(codePoint < 0x800) {
+                    utf8 += char(0xc0 | (codePoint >> 6));
+                    utf8 += char(0x80 | (codePoint & 0x3f));
+                } else if(codePoint < 0x10000) {
+                    utf8 += char(0xe0 | (codePoint >> 12));
+                    utf8 += char(0x80 | ((codePoint >> 6) & 0x3f));
+                    utf8 += char(0x80 | (codePoint & 0x3f));
+                } else {
+                    utf8 += char(0xf0 | (codePoint >> 18));
+                    utf8 += char(0x80 | ((codePoint >> 12) & 0x3f));
+                    utf8 += char(0x80 | ((codePoint >> 6) & 0x3f));
+                    utf8 += char(0x80 | (codePoint & 0x3f));
+                }
+            }
+            
+            // Read the rest of a string after its opening quote.
+            QString readString()
+            {
+                QByteArray utf8;
+                for(;;) {
+                    if(!fill())
+                        error("Unterminated string");
+                    const char *data = _buffer.constData();
+                    const int start = _pos;
+                    while(_pos < _buffer.size() && data[_pos] != '"' && data[_pos] != '\\')
+                        ++_pos;
+                    utf8.append(data + start, _pos - start);
+                    if(_pos == _buffer.size())
+                        continue;
+                    if(data[_pos++] == '"')
+                        return QString::fromUtf8(utf8);
+                    const char escape = get();
+                    switch(escape) {
+                        case '"': utf8 += '"'; break;
+                        case '\\': utf8 += '\\'; break;
+                        case '/': utf8 += '/'; break;
+                        case 'b': utf8 += '\b'; break;
+                        case 'f': utf8 += '\f'; break;
+                        case 'n': utf8 += '\n'; break;
+                        case 'r': utf8 += '\r'; break;
+                        case 't': utf8 += '\t'; break;
+                        case 'u': {
+                            uint codePoint = readHex4();
+                            if(codePoint >= 0xd800 && codePoint < 0xdc00) {
+                                // Surrogate pair.
+                                if(get() != '\\' || get() != 'u')
+                                    error("Invalid surrogate pair");
+                                const uint low = readHex4();
+                                if(low < 0xdc00 || low >= 0xe000)
+                                    error("Invalid surrogate pair");
+                                codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                            } else if(codePoint >= 0xdc00 && codePoint < 0xe000) {
+                                codePoint = 0xfffd;
+                            }
+                            appendUtf8(utf8, codePoint);
+                            break;
+                        }
+                        default:
+                            error("Invalid escape sequence");
+                    }
+                }
+            }
+            
+            QIODevice *_device;
+            QByteArray _buffer;
+            int _pos; // Position in buffer.
+            qint64 _offset; // Device offset of buffer.
+            State _state;
+            // Open containers: '{' or '['.
+            QVector<char> _containers;
+            // Recorded input of earlier chunks, and the start of the recording in the current one (-1 if not recording).
+            QByteArray _capture;
+            int _capturePos;
+        };
+        
+        // Child entry that is left in the file until it is materialized (see LazyDocument).
+        struct PendingChild
+        {
+            QByteArray className;
+            bool inList;
+            qint64 offset; // Of the entry's opening bracket.
+            qint64 size;
+        };
+        
+        struct PendingObject
+        {
+            QPointer<QObject> object; // Guards against a new object at the address of a deleted one.
+            QVector<PendingChild> children;
+        };
+        
+        typedef QHash<const QObject*, PendingObject> PendingObjects;
+        
+        /* --------------------------------------------------------------------------------
+         * Streaming deserializer.
+         * Applies properties and creates children as tokens arrive, following the same
+         * matching rules as deserialize(). Memory depends on tree depth rather than data size,
+         * provided each object's objectName is its first key (as written by the encoders).
+         * Otherwise the object's span is skipped and read again once its objectName is known.
+         * The span is not copied for data that is already in memory. Decoders that cannot
+         * record their input (i.e. CBOR) buffer the object's entries instead.
+         * -------------------------------------------------------------------------------- */
+        class StreamDeserializer
+        {
+        public:
+            StreamDeserializer(Decoder &decoder, const DeserializeContext &context) :
+            _decoder(decoder), _context(context), _depth(0), _eagerDepth(-1), _pending(NULL), _baseOffset(0) {}
+            
+            // Child entries more than eagerDepth levels below the root are skipped and added to pending.
+            // baseOffset is the file offset of the decoder's input.
+            void setLazy(int eagerDepth, PendingObjects *pending, qint64 baseOffset)
+            {
+                _eagerDepth = eagerDepth;
+                _pending = pending;
+                _baseOffset = baseOffset;
+            }
+            
+            void readRoot(QObject *object)
+            {
+                Token token;
+                _decoder.next(token);
+                if(token.type != Token::BeginMap)
+                    throw std::runtime_error("QtPropertySerializer: Document root is not a map");
+                if(object)
+                    readObject(object);
+                else
+                    _decoder.skipContainer();
+                _decoder.next(token);
+                if(token.type != Token::End)
+                    throw std::runtime_error("QtPropertySerializer: Unexpected data after document root");
+            }
+            
+            // Read a single pending child entry (see setLazy()).
+            void readPendingChild(QObject *parent, ChildIndex &existingChildren, const PendingChild &child)
+            {
+                Token token;
+                _decoder.next(token);
+                if(token.type != Token::BeginMap)
+                    throw std::runtime_error("QtPropertySerializer: Pending child is not a map");
+                readChild(parent, existingChildren, child.className, child.inList);
+                _decoder.next(token);
+                if(token.type != Token::End)
+                    throw std::runtime_error("QtPropertySerializer: Unexpected data after pending child");
+            }
+            
+            // Read the entries of a map into object after the map's Begin token.
+            // If given, firstKey and firstValue are an already read entry of the map.
+            void readObject(QObject *object, const QString *firstKey = NULL, const QVariant *firstValue = NULL)
+            {
+                if(_context.statistics)
+                    count(_context.statistics, object->metaObject()->className(), &Statistics::Counts::objectsVisited);
+                const PropertyPlanPointer plan = propertyPlan(object->metaObject());
+                ChildIndex existingChildren(object);
+                if(firstKey)
+                    writeProperty(object, *plan, *firstKey, *firstValue, _context);
+                const bool isLazy = _pending && _eagerDepth >= 0 && _depth >= _eagerDepth;
+                Token token;
+                for(_decoder.next(token); token.type != Token::EndMap; _decoder.next(token)) {
+                    const QString key = token.key;
+                    _decoder.next(token);
+                    if(token.type == Token::BeginMap) {
+                        // Child object.
+                        if(isLazy)
+                            readLazyEntry(object, *plan, key, false);
+                        else
+                            readChild(object, existingChildren, key.toUtf8(), false);
+                    } else if(token.type == Token::BeginArray) {
+                        // List of child objects and/or properties.
+                        const QByteArray className = key.toUtf8();
+                        for(_decoder.next(token); token.type != Token::EndArray; _decoder.next(token)) {
+                            if(token.type == Token::BeginMap && isLazy)
+                                readLazyEntry(object, *plan, key, true);
+                            else if(token.type == Token::BeginMap)
+                                readChild(object, existingChildren, className, true);
+                            else
+                                writeProperty(object, *plan, key, _decoder.readValue(token), _context);
+                        }
+                    } else {
+                        // Property.
+                        writeProperty(object, *plan, key, _decoder.readValue(token), _context);
+                    }
+                }
+            }
+            
+        private:
+            // Read a child entry after its BeginMap token.
+            void readChild(QObject *parent, ChildIndex &existingChildren, const QByteArray &className, bool inList)
+            {
+                const qint64 begin = _decoder.offset() - 1; // Opening bracket.
+                const bool capturing = begin >= 0 && _decoder.beginCapture(begin);
+                Token token;
+                _decoder.next(token);
+                if(token.type == Token::EndMap) {
+                    // Empty map.
+                    _decoder.endCapture();
+                    matchChild(parent, existingChildren, className, inList, NULL, _context);
+                    return;
+                }
+                const QString firstKey = token.key;
+                _decoder.next(token);
+                if(firstKey == QLatin1String("objectName") && token.type == Token::Value) {
+                    // Stream the child.
+                    _decoder.endCapture();
+                    const QVariant objectName = token.value;
+                    if(QObject *child = matchChild(parent, existingChildren, className, inList, &objectName, _context)) {
+                        ++_depth;
+                        readObject(child, &firstKey, &objectName);
+                        --_depth;
+                    } else
+                        _decoder.skipContainer();
+                    return;
+                }
+                if(capturing) {
+                    // We need to know whether the child has an objectName before we can match it,
+                    // so skip to the end of its entry and read it again from the recorded span.
+                    if(token.type == Token::BeginMap || token.type == Token::BeginArray)
+                        _decoder.skipContainer();
+                    _decoder.skipContainer();
+                    readChildSpan(parent, existingChildren, className, inList, _decoder.endCapture(), begin, firstKey.startsWith(QLatin1Char('$')));
+                    return;
+                }
+                // The decoder cannot record its input, so buffer the child's data and deserialize it as a whole.
+                QVariantMap childData;
+                childData.insert(firstKey, _decoder.readValue(token));
+                _decoder.readMapEntries(childData);
+                QVariant binaryValue;
+                if(readBinaryValue(childData, binaryValue)) {
+                    // Property.
+                    writeProperty(parent, *propertyPlan(parent->metaObject()), QString::fromUtf8(className), binaryValue, _context);
+                    return;
+                }
+                if(QObject *child = matchChild(parent, existingChildren, className, inList, objectNameOf(childData), _context))
+                    deserializeObject(child, childData, _context);
+            }
+            
+            // Read a child entry from its recorded span, which starts at begin in the decoder's input.
+            // Only the span's objectName entry is decoded before the child is matched,
+            // unless the span may be a binary array.
+            void readChildSpan(QObject *parent, ChildIndex &existingChildren, const QByteArray &className, bool inList, const QByteArray &span, qint64 begin, bool maybeBinary)
+            {
+                Token token;
+                QVariant objectName;
+                bool hasObjectName = false;
+                if(maybeBinary) {
+                    JsonDecoder decoder(span);
+                    decoder.next(token);
+                    QVariantMap childData;
+                    decoder.readMapEntries(childData);
+                    QVariant binaryValue;
+                    if(readBinaryValue(childData, binaryValue)) {
+                        // Property.
+                        writeProperty(parent, *propertyPlan(parent->metaObject()), QString::fromUtf8(className), binaryValue, _context);
+                        return;
+                    }
+                    if(const QVariant *value = objectNameOf(childData)) {
+                        objectName = *value;
+                        hasObjectName = true;
+                    }
+                } else {
+                    JsonDecoder decoder(span);
+                    decoder.next(token);
+                    for(decoder.next(token); token.type != Token::EndMap; decoder.next(token)) {
+                        const QString key = token.key;
+                        decoder.next(token);
+                        if(key == QLatin1String("objectName")) {
+                            objectName = decoder.readValue(token);
+                            hasObjectName = true;
+                            break;
+                        }
+                        if(token.type == Token::BeginMap || token.type == Token::BeginArray)
+                            decoder.skipContainer();
+                    }
+                }
+                QObject *child = matchChild(parent, existingChildren, className, inList, hasObjectName ? &objectName : NULL, _context);
+                if(!child)
+                    return;
+                // Stream the child from its span, so that its own children are streamed (or left pending) as well.
+                JsonDecoder decoder(span);
+                StreamDeserializer deserializer(decoder, _context);
+                deserializer._depth = _depth + 1;
+                if(_pending)
+                    deserializer.setLazy(_eagerDepth, _pending, _baseOffset + begin);
+                decoder.next(token);
+                deserializer.readObject(child);
+            }
+            
+            // Read a map entry of a lazy object after its BeginMap token.
+            // Binary arrays are properties. Children are skipped and added to the pending children.
+            void readLazyEntry(QObject *object, const PropertyPlan &plan, const QString &key, bool inList)
+            {
+                const qint64 begin = _decoder.offset() - 1; // Opening bracket.
+                Token token;
+                _decoder.next(token);
+                if(token.type == Token::Key && token.key.startsWith(QLatin1Char('$'))) {
+                    // Maybe a {"$type": typeName, "$binary": base64} value (in either key order).
+                    QVariantMap data;
+                    const QString firstKey = token.key;
+                    _decoder.next(token);
+                    data.insert(firstKey, _decoder.readValue(token));
+                    _decoder.readMapEntries(data);
+                    QVariant binaryValue;
+                    if(readBinaryValue(data, binaryValue)) {
+                        writeProperty(object, plan, key, binaryValue, _context);
+                        return;
+                    }
+                } else if(token.type != Token::EndMap) {
+                    _decoder.skipContainer();
+                }
+                addPendingChild(object, key.toUtf8(), inList, begin, _decoder.offset() - begin);
+            }
+            
+            // Add a child entry at offset of size bytes to the parent's pending children.
+            void addPendingChild(QObject *parent, const QByteArray &className, bool inList, qint64 begin, qint64 size)
+            {
+                PendingObject &pendingObject = (*_pending)[parent];
+                if(pendingObject.object != parent) {
+                    pendingObject.object = parent;
+                    pendingObject.children.clear();
+                }
+                PendingChild child;
+                child.className = className;
+                child.inList = inList;
+                child.offset = _baseOffset + begin;
+                child.size = size;
+                pendingObject.children.append(child);
+            }
+            
+            Decoder &_decoder;
+            DeserializeContext _context;
+            // Child levels below the root of the object being read.
+            int _depth;
+            // For lazy reads (see setLazy()).
+            int _eagerDepth;
+            PendingObjects *_pending;
+            qint64 _baseOffset;
+        };
+        
+        /* --------------------------------------------------------------------------------
+         * Read-only file that is memory mapped if possible, so that it can be parsed
+         * straight from the mapped bytes without copying or newline translation.
+         * Files that cannot be mapped (e.g. empty or larger than a QByteArray can hold)
+         * are left to be read through device().
+         * -------------------------------------------------------------------------------- */
+        class MappedFile
+        {
+        public:
+            MappedFile(const QString &filePath, const char *function) : _file(filePath), _map(NULL)
+            {
+                if(!_file.open(QIODevice::ReadOnly))
+                    throw std::runtime_error(std::string("QtPropertySerializer::") + function + ": Failed to open file " + filePath.toStdString());
+                const qint64 size = _file.size();
+                if(size > 0 && size <= std::numeric_limits<int>::max())
+                    _map = _file.map(0, size);
+                if(_map)
+                    _data = QByteArray::fromRawData(reinterpret_cast<const char*>(_map), int(size));
+            }
+            
+            ~MappedFile()
+            {
+                if(_map)
+                    _file.unmap(_map);
+            }
+            
+            bool isMapped() const { return _map; }
+            // The whole file if it is mapped. Only valid for the lifetime of the MappedFile.
+            const QByteArray& data() const { return _data; }
+            QFile* device() { return &_file; }
+            
+        private:
+            Q_DISABLE_COPY(MappedFile)
+            
+            QFile _file;
+            uchar *_map;
+            QByteArray _data;
+        };
+    } // anonymous namespace
+    
+    QVariantMap readJson(const QString &filePath)
+    {
+        MappedFile file(filePath, "readJson");
+        return QJsonDocument::fromJson(file.isMapped() ? file.data() : file.device()->readAll()).toVariant().toMap();
+    }
+    
+    void writeJson(const QVariantMap &data, const QString &filePath, QJsonDocument::JsonFormat format)
+    {
+        QFile file(filePath);
+        if(!file.open(QIODevice::Text | QIODevice::WriteOnly))
+            throw std::runtime_error("QtPropertySerializer::writeJson: Failed to open file " + filePath.toStdString());
+        writeJson(data, &file, format);
+        file.close();
+    }
+    
+    void writeJson(const QVariantMap &data, QIODevice *device, QJsonDocument::JsonFormat format)
+    {
+        JsonEncoder encoder(device, format);
+        encoder.writeMap(data);
+        encoder.finish();
+    }
+    
+    void writeJson(const QObject *object, QIODevice *device, int childDepth, bool includeReadOnlyProperties, QJsonDocument::JsonFormat format, Statistics *statistics)
+    {
+        StatisticsTimer timer(statistics, &Statistics::encodeNsecs);
+        JsonEncoder encoder(device, format);
+        encoder.setStatistics(statistics);
+        encoder.writeObject(object, childDepth, includeReadOnlyProperties);
+        encoder.finish();
+    }
+    
+    namespace
+    {
+        /* --------------------------------------------------------------------------------
+         * Parallel JSON encoding of child subtrees.
+         * Children are snapshotted (i.e. serialize()) on the calling thread and stand in the
+         * root's data as placeholders until their encoded chunks are spliced in.
+         * -------------------------------------------------------------------------------- */
+        const QString& chunkKey()
+        {
+            // Not a valid property or class name.
+            static const QString key = QString(QChar(0)) + "chunk";
+            return key;
+        }
+        
+        // Index of the chunk that value stands in for, or -1.
+        int chunkIndex(const QVariant &value)
+        {
+            if(value.type() != QVariant::Map)
+                return -1;
+            const QVariantMap map = value.toMap();
+            return map.size() == 1 && map.contains(chunkKey()) ? map.value(chunkKey()).toInt() : -1;
+        }
+        
+        struct ParallelJsonJob
+        {
+            QVector<QVariantMap> snapshots;
+            // Nesting level of each snapshot in the document.
+            QVector<int> levels;
+            QVector<QByteArray> chunks;
+            // chunks.data(), taken before the workers start so that they do not have to touch the vector.
+            QByteArray *chunkData;
+            QJsonDocument::JsonFormat format;
+            // Next snapshot to encode. Workers take snapshots one at a time so that they stay busy until all are done.
+            QAtomicInt next;
+            QSemaphore finishedWorkers;
+            // First error of a worker.
+            QMutex errorMutex;
+            std::string error;
+            
+            // Let the other threads stop after their current snapshot.
+            void cancel() { next.storeRelease(snapshots.size()); }
+            
+            void fail(const std::string &message)
+            {
+                QMutexLocker locker(&errorMutex);
+                if(error.empty())
+                    error = message;
+                cancel();
+            }
+            
+            void encode()
+            {
+                const int numSnapshots = snapshots.size();
+                for(int i = next.fetchAndAddOrdered(1); i < numSnapshots; i = next.fetchAndAddOrdered(1)) {
+                    // Each chunk is only touched by one thread.
+                    QBuffer buffer(chunkData + i);
+                    buffer.open(QIODevice::WriteOnly);
+                    JsonEncoder encoder(&buffer, format, levels.at(i));
+                    encoder.writeMap(snapshots.at(i));
+                    encoder.finishValue();
+                }
+            }
+        };
+        
+        class ParallelJsonWorker : public QRunnable
+        {
+        public:
+            explicit ParallelJsonWorker(ParallelJsonJob &job) : _job(job) {}
+            
+            void run() override
+            {
+                try {
+                    _job.encode();
+                } catch(const std::exception &e) {
+                    _job.fail(e.what());
+                }
+                _job.finishedWorkers.release();
+            }
+            
+        private:
+            ParallelJsonJob &_job;
+        };
+        
+        // Waits for the started workers when it goes out of scope, so that the job outlives them
+        // even if the calling thread throws.
+        class ParallelJsonWorkers
+        {
+        public:
+            explicit ParallelJsonWorkers(ParallelJsonJob &job) : _job(job), _numStarted(0) {}
+            
+            ~ParallelJsonWorkers()
+            {
+                if(_numStarted) {
+                    _job.cancel();
+                    wait();
+                }
+            }
+            
+            bool tryStart(QThreadPool *pool)
+            {
+                ParallelJsonWorker *worker = new ParallelJsonWorker(_job);
+                if(!pool->tryStart(worker)) {
+                    delete worker;
+                    return false;
+                }
+                ++_numStarted;
+                return true;
+            }
+            
+            void wait()
+            {
+                _job.finishedWorkers.acquire(_numStarted);
+                _numStarted = 0;
+            }
+            
+        private:
+            Q_DISABLE_COPY(ParallelJsonWorkers)
+            
+            ParallelJsonJob &_job;
+            int _numStarted;
+        };
+        
+        // Write a value of the root's data, splicing in encoded chunks.
+        void writeRootValue(JsonEncoder &encoder, const QVariant &value, const QVector<QByteArray> &chunks)
+        {
+            const int index = chunkIndex(value);
+            if(index != -1) {
+                encoder.raw(chunks.at(index));
+            } else if(value.type() == QVariant::List) {
+                const QVariantList values = value.toList();
+                encoder.beginArray(values.size());
+                for(const QVariant &element : values)
+                    writeRootValue(encoder, element, chunks);
+                encoder.endArray();
+            } else {
+                encoder.writeVariant(value);
+            }
+        }
+    } // anonymous namespace
+    
+    void writeJsonParallel(const QObject *object, QIODevice *device, int childDepth, bool includeReadOnlyProperties, QJsonDocument::JsonFormat format, QThreadPool *pool)
+    {
+        if(!object || childDepth == 0) {
+            writeJson(object, device, childDepth, includeReadOnlyProperties, format);
+            return;
+        }
+        if(!pool)
+            pool = QThreadPool::globalInstance();
+        
+        // Snapshot the children on the calling thread.
+        ParallelJsonJob job;
+        job.format = format;
+        QVariantMap data;
+        addPropertyData(data, object, includeReadOnlyProperties);
+        const int grandchildDepth = childDepth > 0 ? childDepth - 1 : -1;
+        addChildData(data, object->children(), [&job, grandchildDepth, includeReadOnlyProperties](QObject *child) {
+            job.snapshots.append(serializeObject(child, grandchildDepth, includeReadOnlyProperties, NULL));
+            QVariantMap placeholder;
+            placeholder.insert(chunkKey(), job.snapshots.size() - 1);
+            return placeholder;
+        });
+        // Children are in the root map, or in a list in the root map.
+        job.levels.fill(1, job.snapshots.size());
+        for(QVariantMap::const_iterator i = data.constBegin(); i != data.constEnd(); ++i) {
+            if(i.value().type() == QVariant::List) {
+                for(const QVariant &element : i.value().toList()) {
+                    const int index = chunkIndex(element);
+                    if(index != -1)
+                        job.levels[index] = 2;
+                }
+            }
+        }
+        job.chunks.resize(job.snapshots.size());
+        job.chunkData = job.chunks.data();
+        
+        // Encode the children on the pool and on this thread.
+        ParallelJsonWorkers workers(job);
+        const int maxWorkers = qMin(pool->maxThreadCount(), job.snapshots.size() - 1);
+        for(int i = 0; i < maxWorkers && workers.tryStart(pool); ++i) {}
+        job.encode();
+        workers.wait();
+        if(!job.error.empty())
+            throw std::runtime_error(job.error);
+        
+        // Concatenate in order.
+        JsonEncoder encoder(device, format);
+        encoder.beginMap(data.size());
+        // objectName goes first (same as writeJson()).
+        QVariantMap::const_iterator objectName = data.constFind("objectName");
+        if(objectName != data.constEnd()) {
+            encoder.key(objectName.key());
+            encoder.writeVariant(objectName.value());
+        }
+        for(QVariantMap::const_iterator i = data.constBegin(); i != data.constEnd(); ++i) {
+            if(i != objectName) {
+                encoder.key(i.key());
+                writeRootValue(encoder, i.value(), job.chunks);
+            }
+        }
+        encoder.endMap();
+        encoder.finish();
+    }
+    
+    void writeJsonParallel(const QObject *object, const QString &filePath, int childDepth, bool includeReadOnlyProperties, QJsonDocument::JsonFormat format, QThreadPool *pool)
+    {
+        QFile file(filePath);
+        if(!file.open(QIODevice::Text | QIODevice::WriteOnly))
+            throw std::runtime_error("QtPropertySerializer::writeJsonParallel: Failed to open file " + filePath.toStdString());
+        writeJsonParallel(object, &file, childDepth, includeReadOnlyProperties, format, pool);
+        file.close();
+    }
+    
+    void readJson(QObject *object, const QString &filePath, ObjectFactory *factory, DeserializeFlags flags, QList<PropertyChange> *changes, Statistics *statistics)
+    {
+        MappedFile file(filePath, "readJson");
+        if(!file.isMapped()) {
+            readJson(object, file.device(), factory, flags, changes, statistics);
+            return;
+        }
+        StatisticsTimer timer(statistics, &Statistics::parseNsecs);
+        JsonDecoder decoder(file.data());
+        StreamDeserializer deserializer(decoder, DeserializeContext(factory, flags, changes, statistics));
+        deserializer.readRoot(object);
+    }
+    
+    void readJson(QObject *object, QIODevice *device, ObjectFactory *factory, DeserializeFlags flags, QList<PropertyChange> *changes, Statistics *statistics)
+    {
+        StatisticsTimer timer(statistics, &Statistics::parseNsecs);
+        JsonDecoder decoder(device);
+        StreamDeserializer deserializer(decoder, DeserializeContext(factory, flags, changes, statistics));
+        deserializer.readRoot(object);
+    }
+    
+    void writeJson(QObject *object, const QString &filePath, int childDepth, bool includeReadOnlyProperties, QJsonDocument::JsonFormat format, Statistics *statistics)
+    {
+        QFile file(filePath);
+        if(!file.open(QIODevice::Text | QIODevice::WriteOnly))
+            throw std::runtime_error("QtPropertySerializer::writeJson: Failed to open file " + filePath.toStdString());
+        writeJson(object, &file, childDepth, includeReadOnlyProperties, format, statistics);
+        file.close();
+    }
+    
+    /* --------------------------------------------------------------------------------
+     * NDJSON
+     * -------------------------------------------------------------------------------- */
+    namespace
+    {
+        // Batches of lines parsed by one worker task.
+        const int NdjsonBatchLines = 1024;
+        const qint64 NdjsonBatchBytes = 1024 * 1024;
+        
+        void writeNdjsonNewline(QIODevice *device)
+        {
+            if(device->write("\n", 1) != 1)
+                throw std::runtime_error("QtPropertySerializer::writeNdjson: Failed to write to device: " + device->errorString().toStdString());
+        }
+        
+        bool isBlankLine(const QByteArray &line)
+        {
+            for(char c : line) {
+                if(c != ' ' && c != '\t' && c != '\r' && c != '\n')
+                    return false;
+            }
+            return true;
+        }
+        
+        QVariantMap readNdjsonRecord(const QByteArray &line)
+        {
+            JsonDecoder decoder(line);
+            Token token;
+            decoder.next(token);
+            if(token.type != Token::BeginMap)
+                throw std::runtime_error("QtPropertySerializer::readNdjson: Record is not an object");
+            const QVariantMap data = decoder.readContainer(token).toMap();
+            decoder.next(token);
+            if(token.type != Token::End)
+                throw std::runtime_error("QtPropertySerializer::readNdjson: Unexpected data after record");
+            return data;
+        }
+        
+        struct NdjsonBatch
+        {
+            QVector<QByteArray> lines;
+            QVector<QVariantMap> records;
+            std::string error;
+            // Set by the thread that parses the batch: a pool thread, or else the reading thread.
+            QAtomicInt claimed;
+            // Released when records (or error) are ready.
+            QSemaphore done;
+            
+            // Returns false if another thread has already claimed the batch.
+            bool claim() { return claimed.testAndSetOrdered(0, 1); }
+            
+            void parse()
+            {
+                try {
+                    records.reserve(lines.size());
+                    for(const QByteArray &line : lines)
+                        records.append(readNdjsonRecord(line));
+                } catch(const std::exception &e) {
+                    error = e.what();
+                }
+                lines.clear();
+                done.release();
+            }
+        };
+        
+        // Shares the batch, so that a task that is dequeued late finds it claimed rather than deleted.
+        class NdjsonParseTask : public QRunnable
+        {
+        public:
+            explicit NdjsonParseTask(const QSharedPointer<NdjsonBatch> &batch) : _batch(batch) {}
+            
+            void run() override
+            {
+                if(_batch->claim())
+                    _batch->parse();
+            }
+            
+        private:
+            QSharedPointer<NdjsonBatch> _batch;
+        };
+        
+        // Drop queued batches that will not be read. Batches that are being parsed finish on their own.
+        void dropNdjsonBatches(QList<QSharedPointer<NdjsonBatch> > &batches)
+        {
+            for(const QSharedPointer<NdjsonBatch> &batch : batches)
+                batch->claim();
+            batches.clear();
+        }
+    } // anonymous namespace
+    
+    void writeNdjson(const QObject *object, QIODevice *device, int childDepth, bool includeReadOnlyProperties)
+    {
+        JsonEncoder encoder(device, QJsonDocument::Compact);
+        encoder.writeObject(object, childDepth, includeReadOnlyProperties);
+        encoder.finish();
+        writeNdjsonNewline(device);
+    }
+    
+    void writeNdjson(const QVariantMap &data, QIODevice *device)
+    {
+        JsonEncoder encoder(device, QJsonDocument::Compact);
+        encoder.writeMap(data);
+        encoder.finish();
+        writeNdjsonNewline(device);
+    }
+    
+    void writeNdjson(const QList<QObject*> &objects, QIODevice *device, int childDepth, bool includeReadOnlyProperties)
+    {
+        for(QObject *object : objects)
+            writeNdjson(object, device, childDepth, includeReadOnlyProperties);
+    }
+    
+    qint64 readNdjson(QIODevice *device, const NdjsonCallback &callback)
+    {
+        if(!device || !device->isReadable())
+            throw std::runtime_error("QtPropertySerializer::readNdjson: Device is not open for reading");
+        qint64 count = 0;
+        while(!device->atEnd()) {
+            const QByteArray line = device->readLine();
+            if(isBlankLine(line))
+                continue;
+            ++count;
+            if(!callback(readNdjsonRecord(line)))
+                break;
+        }
+        return count;
+    }
+    
+    qint64 readNdjsonParallel(QIODevice *device, const NdjsonCallback &callback, QThreadPool *pool)
+    {
+        if(!device || !device->isReadable())
+            throw std::runtime_error("QtPropertySerializer::readNdjson: Device is not open for reading");
+        if(!pool)
+            pool = QThreadPool::globalInstance();
+        // Enough batches to keep the pool busy while the oldest one is handed to callback.
+        const int maxBatches = 2 * qMax(1, pool->maxThreadCount());
+        // Queued batches in input order.
+        QList<QSharedPointer<NdjsonBatch> > batches;
+        qint64 count = 0;
+        bool isReading = true;
+        try {
+            forever {
+                while(isReading && batches.size() < maxBatches) {
+                    QSharedPointer<NdjsonBatch> batch(new NdjsonBatch);
+                    qint64 size = 0;
+                    while(batch->lines.size() < NdjsonBatchLines && size < NdjsonBatchBytes && !device->atEnd()) {
+                        const QByteArray line = device->readLine();
+                        if(isBlankLine(line))
+                            continue;
+                        size += line.size();
+                        batch->lines.append(line);
+                    }
+                    isReading = !device->atEnd();
+                    if(batch->lines.isEmpty())
+                        break;
+                    batches.append(batch);
+                    pool->start(new NdjsonParseTask(batch));
+                }
+                if(batches.isEmpty())
+                    return count;
+                const QSharedPointer<NdjsonBatch> batch = batches.takeFirst();
+                // Parse the batch here if no pool thread has started it (e.g. the pool is busy, or this
+                // is one of its threads), so that we only ever wait for a batch that is being parsed.
+                if(batch->claim())
+                    batch->parse();
+                batch->done.acquire();
+                if(!batch->error.empty())
+                    throw std::runtime_error(batch->error);
+                for(const QVariantMap &record : batch->records) {
+                    ++count;
+                    if(!callback(record)) {
+                        dropNdjsonBatches(batches);
+                        return count;
+                    }
+                }
+            }
+        } catch(...) {
+            dropNdjsonBatches(batches);
+            throw;
+        }
+    }
+    
+    /* --------------------------------------------------------------------------------
+     * LazyDocument
+     * -------------------------------------------------------------------------------- */
+    struct LazyDocument::Private
+    {
+        QScopedPointer<MappedFile> file;
+        ObjectFactory *factory;
+        DeserializeFlags flags;
+        PendingObjects pending;
+        
+        Private() : factory(NULL) {}
+        
+        // Not copied if the file is mapped, otherwise read from the file.
+        QByteArray span(qint64 offset, qint64 size)
+        {
+            if(file->isMapped())
+                return QByteArray::fromRawData(file->data().constData() + offset, int(size));
+            QFile *device = file->device();
+            if(!device->seek(offset))
+                throw std::runtime_error("QtPropertySerializer::LazyDocument: Failed to seek in file " + device->fileName().toStdString());
+            const QByteArray data = device->read(size);
+            if(data.size() != size)
+                throw std::runtime_error("QtPropertySerializer::LazyDocument: Failed to read file " + device->fileName().toStdString());
+            return data;
+        }
+    };
+    
+    LazyDocument::LazyDocument() : d(new Private)
+    {
+    }
+    
+    LazyDocument::~LazyDocument()
+    {
+        close();
+        delete d;
+    }
+    
+    void LazyDocument::open(QObject *object, const QString &filePath, int eagerDepth, ObjectFactory *factory, DeserializeFlags flags)
+    {
+        close();
+        d->file.reset(new MappedFile(filePath, "LazyDocument"));
+        d->factory = factory;
+        d->flags = flags;
+        try {
+            const DeserializeContext context(factory, flags);
+            if(d->file->isMapped()) {
+                JsonDecoder decoder(d->file->data());
+                StreamDeserializer deserializer(decoder, context);
+                deserializer.setLazy(eagerDepth, &d->pending, 0);
+                deserializer.readRoot(object);
+            } else {
+                // Too large to map, so only the pending spans are read later.
+                JsonDecoder decoder(d->file->device());
+                StreamDeserializer deserializer(decoder, context);
+                deserializer.setLazy(eagerDepth, &d->pending, 0);
+                deserializer.readRoot(object);
+            }
+        } catch(...) {
+            close();
+            throw;
+        }
+    }
+    
+    void LazyDocument::close()
+    {
+        d->pending.clear();
+        d->file.reset();
+    }
+    
+    bool LazyDocument::isPending(const QObject *object) const
+    {
+        PendingObjects::const_iterator it = d->pending.constFind(object);
+        return it != d->pending.constEnd() && it->object == object;
+    }
+    
+    QList<QObject*> LazyDocument::pendingObjects() const
+    {
+        QList<QObject*> objects;
+        for(PendingObjects::const_iterator it = d->pending.constBegin(); it != d->pending.constEnd(); ++it) {
+            if(it->object == it.key())
+                objects.append(it->object);
+        }
+        return objects;
+    }
+    
+    qint64 LazyDocument::pendingSize() const
+    {
+        qint64 size = 0;
+        for(PendingObjects::const_iterator it = d->pending.constBegin(); it != d->pending.constEnd(); ++it) {
+            if(it->object == it.key()) {
+                for(const PendingChild &child : it->children)
+                    size += child.size;
+            }
+        }
+        return size;
+    }
+    
+    void LazyDocument::materialize(QObject *object, int childDepth)
+    {
+        if(!d->file || childDepth == 0)
+            return;
+        PendingObjects::iterator it = d->pending.find(object);
+        if(it == d->pending.end())
+            return;
+        const PendingObject pendingObject = it.value();
+        d->pending.erase(it);
+        if(pendingObject.object != object)
+            return;
+        const DeserializeContext context(d->factory, d->flags);
+        ChildIndex existingChildren(object);
+        for(const PendingChild &child : pendingObject.children) {
+            JsonDecoder decoder(d->span(child.offset, child.size));
+            StreamDeserializer deserializer(decoder, context);
+            deserializer.setLazy(childDepth, &d->pending, child.offset);
+            deserializer.readPendingChild(object, existingChildren, child);
+        }
+    }
+    
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    namespace
+    {
+        /* --------------------------------------------------------------------------------
+         * Streaming CBOR encoder.
+         * Map keys (i.e. class and property names) are interned: the first occurrence of a key
+         * is written as a text string, and every later occurrence as the unsigned integer index
+         * of its first occurrence. Values are written natively (integers, doubles, byte arrays, ...).
+         * -------------------------------------------------------------------------------- */
+        // Buffers writes to a device in bounded chunks and remembers failed writes,
+        // which QCborStreamWriter ignores.
+        class CborOutputDevice : public QIODevice
+        {
+        public:
+            explicit CborOutputDevice(QIODevice *device) : _device(device), _failed(false)
+            {
+                _buffer.reserve(BufferSize + BufferSize / 4);
+                open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+            }
+            
+            // Returns false if any write to the device failed.
+            bool flush()
+            {
+                if(!_buffer.isEmpty() && !_failed) {
+                    const char *data = _buffer.constData();
+                    qint64 remaining = _buffer.size();
+                    while(remaining > 0) {
+                        const qint64 written = _device->write(data, remaining);
+                        if(written <= 0) {
+                            _failed = true;
+                            break;
+                        }
+                        data += written;
+                        remaining -= written;
+                    }
+                }
+                _buffer.resize(0);
+                return !_failed;
+            }
+            
+        protected:
+            qint64 readData(char*, qint64) override { return -1; }
+            
+            qint64 writeData(const char *data, qint64 size) override
+            {
+                if(_failed)
+                    return -1;
+                _buffer.append(data, int(size));
+                if(_buffer.size() >= BufferSize && !flush())
+                    return -1;
+                return size;
+            }
+            
+        private:
+            static const int BufferSize = 64 * 1024;
+            
+            QIODevice *_device;
+            QByteArray _buffer;
+            bool _failed;
+        };
+        
+        class CborEncoder : public Encoder
+        {
+        public:
+            explicit CborEncoder(QIODevice *device) : _device(device), _output(device), _writer(&_output)
+            {
+                if(!_device || !_device->isWritable())
+                    throw std::runtime_error("QtPropertySerializer::writeCbor: Device is not open for writing");
+                // Self-describing CBOR.
+                _writer.append(QCborKnownTags::Signature);
+            }
+            
+            void beginMap(int size) override { _writer.startMap(quint64(size)); }
+            void endMap() override { _writer.endMap(); }
+            void beginArray(int size) override { _writer.startArray(quint64(size)); }
+            void endArray() override { _writer.endArray(); }
+            
+            void key(const QString &key) override
+            {
+                QHash<QString, quint64>::const_iterator it = _strings.constFind(key);
+                if(it != _strings.constEnd()) {
+                    _writer.append(it.value());
+                } else {
+                    _strings.insert(key, quint64(_strings.size()));
+                    _writer.append(key);
+                }
+            }
+            
+            void value(const QVariant &value) override
+            {
+                const BinaryArrayType *type = binaryArrayTypeOf(value.userType());
+                if(type && type->cborTag) {
+                    _writer.append(QCborTag(type->cborTag));
+                    _writer.append(type->pack(value));
+                    return;
+                }
+                switch(int(value.userType())) {
+                    case QMetaType::UnknownType:
+                        _writer.appendNull();
+                        break;
+                    case QMetaType::Bool:
+                        _writer.append(value.toBool());
+                        break;
+                    case QMetaType::Int:
+                    case QMetaType::LongLong:
+                    case QMetaType::Short:
+                    case QMetaType::Long:
+                        _writer.append(qint64(value.toLongLong()));
+                        break;
+                    case QMetaType::UInt:
+                    case QMetaType::ULongLong:
+                    case QMetaType::UShort:
+                    case QMetaType::ULong:
+                        _writer.append(quint64(value.toULongLong()));
+                        break;
+                    case QMetaType::Float:
+                        _writer.append(value.toFloat());
+                        break;
+                    case QMetaType::Double:
+                        _writer.append(value.toDouble());
+                        break;
+                    case QMetaType::QString:
+                        _writer.append(value.toString());
+                        break;
+                    case QMetaType::QByteArray:
+                        _writer.append(value.toByteArray());
+                        break;
+                    case QMetaType::QStringList: {
+                        const QStringList strings = value.toStringList();
+                        _writer.startArray(quint64(strings.size()));
+                        for(const QString &string : strings)
+                            _writer.append(string);
+                        _writer.endArray();
+                        break;
+                    }
+                    default:
+                        writeCborValue(QCborValue::fromVariant(value));
+                }
+            }
+            
+            void boundValue(const BoundValue &value) override
+            {
+                switch(value.type) {
+                    case BoundValue::Bool: _writer.append(value.boolValue); break;
+                    case BoundValue::Int: _writer.append(qint64(value.intValue)); break;
+                    case BoundValue::LongLong: _writer.append(value.longLongValue); break;
+                    case BoundValue::Double: _writer.append(value.doubleValue); break;
+                    case BoundValue::String: _writer.append(value.stringValue); break;
+                    default: this->value(value.variantValue);
+                }
+            }
+            
+            void finish()
+            {
+                if(!_output.flush())
+                    throw std::runtime_error("QtPropertySerializer::writeCbor: Failed to write to device: " + _device->errorString().toStdString());
+            }
+            
+        private:
+            // Map keys of e.g. QVariantHash or QJsonObject values go through key() so that
+            // the decoder's table of interned keys stays in step with ours.
+            void writeCborValue(const QCborValue &value)
+            {
+                if(value.isMap()) {
+                    const QCborMap map = value.toMap();
+                    _writer.startMap(quint64(map.size()));
+                    for(QCborMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+                        key(it.key().isString() ? it.key().toString() : it.key().toDiagnosticNotation());
+                        writeCborValue(it.value());
+                    }
+                    _writer.endMap();
+                } else if(value.isArray()) {
+                    const QCborArray array = value.toArray();
+                    _writer.startArray(quint64(array.size()));
+                    for(const QCborValue &element : array)
+                        writeCborValue(element);
+                    _writer.endArray();
+                } else if(value.isTag()) {
+                    _writer.append(value.tag());
+                    writeCborValue(value.taggedValue());
+                } else {
+                    value.toCbor(_writer);
+                }
+            }
+            
+            QIODevice *_device;
+            CborOutputDevice _output;
+            QCborStreamWriter _writer;
+            // Interned key --> index.
+            QHash<QString, quint64> _strings;
+        };
+        
+        /* --------------------------------------------------------------------------------
+         * Streaming CBOR decoder for data written by CborEncoder.
+         * -------------------------------------------------------------------------------- */
+        class CborDecoder : public Decoder
+        {
+        public:
+            explicit CborDecoder(QIODevice *device) : _reader(device), _rootDone(false)
+            {
+                if(!device || !device->isReadable())
+                    throw std::runtime_error("QtPropertySerializer::readCbor: Device is not open for reading");
+            }
+            
+            // data is not copied (e.g. QByteArray::fromRawData() of a mapped file).
+            explicit CborDecoder(const QByteArray &data) : _reader(data), _rootDone(false) {}
+            
+            void next(Token &token) override
+            {
+                if(!_containers.isEmpty()) {
+                    Container &container = _containers.last();
+                    if(!_reader.hasNext()) {
+                        token.type = container.isMap ? Token::EndMap : Token::EndArray;
+                        _containers.removeLast();
+                        if(!_reader.leaveContainer())
+                            error();
+                        valueDone();
+                        return;
+                    }
+                    if(container.isMap && container.expectKey) {
+                        token.type = Token::Key;
+                        token.key = readKey();
+                        container.expectKey = false;
+                        return;
+                    }
+                } else if(_rootDone) {
+                    token.type = Token::End;
+                    return;
+                }
+                readValueToken(token);
+            }
+            
+        private:
+            struct Container
+            {
+                bool isMap;
+                bool expectKey;
+            };
+            
+            void error(const char *message = NULL)
+            {
+                const std::string reason = message ? std::string(message) : _reader.lastError().toString().toStdString();
+                throw std::runtime_error("QtPropertySerializer::readCbor: " + reason + " at offset " + QByteArray::number(_reader.currentOffset()).toStdString());
+            }
+            
+            void valueDone()
+            {
+                if(_containers.isEmpty())
+                    _rootDone = true;
+                else if(_containers.last().isMap)
+                    _containers.last().expectKey = true;
+            }
+            
+            QString readString()
+            {
+                QString string;
+                QCborStreamReader::StringResult<QString> result = _reader.readString();
+                while(result.status == QCborStreamReader::Ok) {
+                    string += result.data;
+                    result = _reader.readString();
+                }
+                if(result.status == QCborStreamReader::Error)
+                    error();
+                return string;
+            }
+            
+            QByteArray readByteArray()
+            {
+                QByteArray bytes;
+                QCborStreamReader::StringResult<QByteArray> result = _reader.readByteArray();
+                while(result.status == QCborStreamReader::Ok) {
+                    bytes += result.data;
+                    result = _reader.readByteArray();
+                }
+                if(result.status == QCborStreamReader::Error)
+                    error();
+                return bytes;
+            }
+            
+            QString readKey()
+            {
+                if(_reader.isUnsignedInteger()) {
+                    const quint64 index = _reader.toUnsignedInteger();
+                    _reader.next();
+                    if(index >= quint64(_strings.size()))
+                        error("Invalid key reference");
+                    return _strings.at(int(index));
+                }
+                if(!_reader.isString())
+                    error("Invalid key");
+                const QString key = readString();
+                _strings.append(key);
+                return key;
+            }
+            
+            // Read a complete value. Map keys go through readKey(), as the encoder interns
+            // the keys of maps inside tagged values too (unlike QCborValue::fromCbor()).
+            QCborValue readCborValue()
+            {
+                QCborValue value;
+                switch(_reader.type()) {
+                    case QCborStreamReader::UnsignedInteger: {
+                        const quint64 number = _reader.toUnsignedInteger();
+                        value = number <= quint64(std::numeric_limits<qint64>::max()) ? QCborValue(qint64(number)) : QCborValue(double(number));
+                        _reader.next();
+                        break;
+                    }
+                    case QCborStreamReader::NegativeInteger:
+                        value = QCborValue(_reader.toInteger());
+                        _reader.next();
+                        break;
+                    case QCborStreamReader::ByteArray:
+                        value = QCborValue(readByteArray());
+                        break;
+                    case QCborStreamReader::String:
+                        value = QCborValue(readString());
+                        break;
+                    case QCborStreamReader::Array: {
+                        QCborArray array;
+                        if(!_reader.enterContainer())
+                            error();
+                        while(_reader.hasNext())
+                            array.append(readCborValue());
+                        if(!_reader.leaveContainer())
+                            error();
+                        value = array;
+                        break;
+                    }
+                    case QCborStreamReader::Map: {
+                        QCborMap map;
+                        if(!_reader.enterContainer())
+                            error();
+                        while(_reader.hasNext()) {
+                            const QString key = readKey();
+                            map.insert(key, readCborValue());
+                        }
+                        if(!_reader.leaveContainer())
+                            error();
+                        value = map;
+                        break;
+                    }
+                    case QCborStreamReader::SimpleType:
+                        value = QCborValue(_reader.toSimpleType());
+                        _reader.next();
+                        break;
+                    case QCborStreamReader::Float16:
+                        value = QCborValue(double(_reader.toFloat16()));
+                        _reader.next();
+                        break;
+                    case QCborStreamReader::Float:
+                        value = QCborValue(double(_reader.toFloat()));
+                        _reader.next();
+                        break;
+                    case QCborStreamReader::Double:
+                        value = QCborValue(_reader.toDouble());
+                        _reader.next();
+                        break;
+                    case QCborStreamReader::Tag: {
+                        const QCborTag tag = _reader.toTag();
+                        _reader.next();
+                        value = QCborValue(tag, readCborValue());
+                        break;
+                    }
+                    default:
+                        error(_reader.lastError() == QCborError::NoError ? "Unexpected end of data" : NULL);
+                }
+                if(_reader.lastError() != QCborError::NoError)
+                    error();
+                return value;
+            }
+            
+            void readValueToken(Token &token)
+            {
+                // Skip the self-describing CBOR signature.
+                while(_reader.isTag() && _reader.toTag() == QCborTag(QCborKnownTags::Signature))
+                    _reader.next();
+                token.type = Token::Value;
+                switch(_reader.type()) {
+                    case QCborStreamReader::UnsignedInteger: {
+                        const quint64 value = _reader.toUnsignedInteger();
+                        if(value <= quint64(std::numeric_limits<int>::max()))
+                            token.value = int(value);
+                        else if(value <= quint64(std::numeric_limits<qint64>::max()))
+                            token.value = qint64(value);
+                        else
+                            token.value = value;
+                        _reader.next();
+                        break;
+                    }
+                    case QCborStreamReader::NegativeInteger: {
+                        const qint64 value = _reader.toInteger();
+                        if(value >= qint64(std::numeric_limits<int>::min()))
+                            token.value = int(value);
+                        else
+                            token.value = value;
+                        _reader.next();
+                        break;
+                    }
+                    case QCborStreamReader::ByteArray:
+                        token.value = readByteArray();
+                        break;
+                    case QCborStreamReader::String:
+                        token.value = readString();
+                        break;
+                    case QCborStreamReader::Array:
+                    case QCborStreamReader::Map: {
+                        Container container;
+                        container.isMap = _reader.isMap();
+                        container.expectKey = true;
+                        token.type = container.isMap ? Token::BeginMap : Token::BeginArray;
+                        if(!_reader.enterContainer())
+                            error();
+                        _containers.append(container);
+                        // The container is done once its End token is read.
+                        return;
+                    }
+                    case QCborStreamReader::SimpleType:
+                        if(_reader.isFalse() || _reader.isTrue())
+                            token.value = _reader.toBool();
+                        else
+                            token.value = QVariant();
+                        _reader.next();
+                        break;
+                    case QCborStreamReader::Float16:
+                        token.value = float(_reader.toFloat16());
+                        _reader.next();
+                        break;
+                    case QCborStreamReader::Float:
+                        token.value = _reader.toFloat();
+                        _reader.next();
+                        break;
+                    case QCborStreamReader::Double:
+                        token.value = _reader.toDouble();
+                        _reader.next();
+                        break;
+                    case QCborStreamReader::Tag:
+                        if(const BinaryArrayType *type = binaryArrayTypeTagged(quint64(_reader.toTag()))) {
+                            // Typed array.
+                            _reader.next();
+                            if(!_reader.isByteArray())
+                                error("Invalid typed array");
+                            token.value = type->unpack(readByteArray());
+                            break;
+                        }
+                        // Other tagged values (e.g. date/time) are decoded as a whole.
+                        token.value = readCborValue().toVariant();
+                        break;
+                    default:
+                        error(_reader.lastError() == QCborError::NoError ? "Unexpected end of data" : NULL);
+                }
+                if(_reader.lastError() != QCborError::NoError)
+                    error();
+                valueDone();
+            }
+            
+            QCborStreamReader _reader;
+            QVector<Container> _containers;
+            // Interned keys in order of first occurrence.
+            QVector<QString> _strings;
+            bool _rootDone;
+        };
+        
+        // Read a whole document into a QVariantMap.
+        QVariantMap readCborRoot(CborDecoder &decoder)
+        {
+            Token token;
+            decoder.next(token);
+            if(token.type != Token::BeginMap)
+                throw std::runtime_error("QtPropertySerializer::readCbor: Document root is not a map");
+            const QVariantMap data = decoder.readContainer(token).toMap();
+            decoder.next(token);
+            if(token.type != Token::End)
+                throw std::runtime_error("QtPropertySerializer::readCbor: Unexpected data after document root");
+            return data;
+        }
+    } // anonymous namespace
+    
+    QVariantMap readCbor(const QString &filePath)
+    {
+        MappedFile file(filePath, "readCbor");
+        if(!file.isMapped())
+            return readCbor(file.device());
+        CborDecoder decoder(file.data());
+        return readCborRoot(decoder);
+    }
+    
+    void writeCbor(const QVariantMap &data, const QString &filePath)
+    {
+        QFile file(filePath);
+        if(!file.open(QIODevice::WriteOnly))
+            throw std::runtime_error("QtPropertySerializer::writeCbor: Failed to open file " + filePath.toStdString());
+        writeCbor(data, &file);
+        file.close();
+    }
+    
+    void readCbor(QObject *object, const QString &filePath, ObjectFactory *factory, DeserializeFlags flags, QList<PropertyChange> *changes, Statistics *statistics)
+    {
+        MappedFile file(filePath, "readCbor");
+        if(!file.isMapped()) {
+            readCbor(object, file.device(), factory, flags, changes, statistics);
+            return;
+        }
+        StatisticsTimer timer(statistics, &Statistics::parseNsecs);
+        CborDecoder decoder(file.data());
+        StreamDeserializer deserializer(decoder, DeserializeContext(factory, flags, changes, statistics));
+        deserializer.readRoot(object);
+    }
+    
+    void writeCbor(QObject *object, const QString &filePath, int childDepth, bool includeReadOnlyProperties, Statistics *statistics)
+    {
+        QFile file(filePath);
+        if(!file.open(QIODevice::WriteOnly))
+            throw std::runtime_error("QtPropertySerializer::writeCbor: Failed to open file " + filePath.toStdString());
+        writeCbor(object, &file, childDepth, includeReadOnlyProperties, statistics);
+        file.close();
+    }
+    
+    QVariantMap readCbor(QIODevice *device)
+    {
+        CborDecoder decoder(device);
+        return readCborRoot(decoder);
+    }
+    
+    void writeCbor(const QVariantMap &data, QIODevice *device)
+    {
+        CborEncoder encoder(device);
+        encoder.writeMap(data);
+        encoder.finish();
+    }
+    
+    void readCbor(QObject *object, QIODevice *device, ObjectFactory *factory, DeserializeFlags flags, QList<PropertyChange> *changes, Statistics *statistics)
+    {
+        StatisticsTimer timer(statistics, &Statistics::parseNsecs);
+        CborDecoder decoder(device);
+        StreamDeserializer deserializer(decoder, DeserializeContext(factory, flags, changes, statistics));
+        deserializer.readRoot(object);
+    }
+    
+    void writeCbor(const QObject *object, QIODevice *device, int childDepth, bool includeReadOnlyProperties, Statistics *statistics)
+    {
+        StatisticsTimer timer(statistics, &Statistics::encodeNsecs);
+        CborEncoder encoder(device);
+        encoder.setStatistics(statistics);
+        encoder.writeObject(object, childDepth, includeReadOnlyProperties);
+        encoder.finish();
+    }
+#endif
+    
+    /* --------------------------------------------------------------------------------
+     * Content hashing
+     * -------------------------------------------------------------------------------- */
+    namespace
+    {
+        const QCryptographicHash::Algorithm HashAlgorithm = QCryptographicHash::Sha1;
+        
+        QByteArray hashMap(const QVariantMap &data);
+        QByteArray hashList(const QVariantList &values);
+        
+        void addKeyToHash(QCryptographicHash &hash, const QString &key)
+        {
+            const QByteArray utf8 = key.toUtf8();
+            // Including the terminating null so that keys and values cannot run into each other.
+            hash.addData(utf8.constData(), utf8.size() + 1);
+        }
+        
+        // Nested maps and lists are added as their own hashes.
+        void addValueToHash(QCryptographicHash &hash, const QVariant &value)
+        {
+            if(value.type() == QVariant::Map) {
+                hash.addData(hashMap(value.toMap()));
+                return;
+            }
+            if(value.type() == QVariant::List) {
+                hash.addData(hashList(value.toList()));
+                return;
+            }
+            QByteArray bytes;
+            QDataStream stream(&bytes, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_5_0);
+            const int userType = value.userType();
+            // Type names rather than ids, which may differ between runs for custom types.
+            stream << QByteArray(value.typeName());
+            if(const BinaryArrayType *type = binaryArrayTypeOf(userType))
+                stream << type->pack(value);
+            else if(value.isValid() && !QMetaType::save(stream, userType, value.constData()))
+                stream << value.toString();
+            hash.addData("V", 1);
+            hash.addData(bytes);
+        }
+        
+        QByteArray hashMap(const QVariantMap &data)
+        {
+            QCryptographicHash hash(HashAlgorithm);
+            hash.addData("M", 1);
+            for(QVariantMap::const_iterator it = data.constBegin(); it != data.constEnd(); ++it) {
+                addKeyToHash(hash, it.key());
+                addValueToHash(hash, it.value());
+            }
+            return hash.result();
+        }
+        
+        QByteArray hashList(const QVariantList &values)
+        {
+            QCryptographicHash hash(HashAlgorithm);
+            hash.addData("L", 1);
+            for(const QVariant &value : values)
+                addValueToHash(hash, value);
+            return hash.result();
+        }
+    } // anonymous namespace
+    
+    QByteArray contentHash(const QVariantMap &data)
+    {
+        return hashMap(data);
+    }
+    
+    QByteArray contentHash(const QObject *object, int childDepth, bool includeReadOnlyProperties)
+    {
+        return hashMap(serialize(object, childDepth, includeReadOnlyProperties));
+    }
+    
+    /* --------------------------------------------------------------------------------
+     * AsyncWriter
+     * -------------------------------------------------------------------------------- */
+    namespace
+    {
+        // Format passed to AsyncWriter::enqueue(). JSON formats are QJsonDocument::JsonFormat values.
+        const int CborFormat = -1;
+        
+        // Write data to filePath, atomically replacing any existing file.
+        bool saveFile(const QVariantMap &data, const QString &filePath, int format, QString &errorString)
+        {
+            QSaveFile file(filePath);
+            if(!file.open(format == CborFormat ? QIODevice::WriteOnly : QIODevice::WriteOnly | QIODevice::Text)) {
+                errorString = file.errorString();
+                return false;
+            }
+            try {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+                if(format == CborFormat)
+                    writeCbor(data, &file);
+                else
+#endif
+                    writeJson(data, &file, QJsonDocument::JsonFormat(format));
+            } catch(const std::exception &e) {
+                file.cancelWriting();
+                errorString = QString::fromUtf8(e.what());
+                return false;
+            }
+            // Syncs the temporary file to disk and renames it to filePath.
+            if(!file.commit()) {
+                errorString = file.errorString();
+                return false;
+            }
+            return true;
+        }
+    } // anonymous namespace
+    
+    struct AsyncWriter::Private
+    {
+        struct Job
+        {
+            QVariantMap data;
+            int format;
+            QList<QFutureInterface<bool> > futures;
+        };
+        
+        QMutex mutex;
+        // Newest pending job for each file.
+        QHash<QString, Job> pendingJobs;
+        // Files that have a worker task.
+        QSet<QString> activeFiles;
+        QThreadPool pool;
+        bool skipUnchangedWrites;
+        // Format and contentHash() of the last data written to each file.
+        QHash<QString, QPair<int, QByteArray> > writtenHashes;
+        
+        Private() : skipUnchangedWrites(false) {}
+    };
+    
+    // Worker that writes the pending jobs for a file until there are none left.
+    class AsyncWriterTask : public QRunnable
+    {
+    public:
+        AsyncWriterTask(AsyncWriter *writer, const QString &filePath) : _writer(writer), _filePath(filePath) {}
+        
+        void run() override
+        {
+            AsyncWriter::Private *d = _writer->d;
+            forever {
+                AsyncWriter::Private::Job job;
+                bool skipUnchangedWrites;
+                QPair<int, QByteArray> writtenHash;
+                {
+                    QMutexLocker locker(&d->mutex);
+                    QHash<QString, AsyncWriter::Private::Job>::iterator it = d->pendingJobs.find(_filePath);
+                    if(it == d->pendingJobs.end()) {
+                        d->activeFiles.remove(_filePath);
+                        return;
+                    }
+                    job = it.value();
+                    d->pendingJobs.erase(it);
+                    skipUnchangedWrites = d->skipUnchangedWrites;
+                    writtenHash = d->writtenHashes.value(_filePath);
+                }
+                QString errorString;
+                bool ok = true;
+                // Hash on the worker thread so that the caller only pays for the snapshot.
+                const QPair<int, QByteArray> hash(job.format, skipUnchangedWrites ? contentHash(job.data) : QByteArray());
+                if(!skipUnchangedWrites || hash != writtenHash || !QFile::exists(_filePath)) {
+                    ok = saveFile(job.data, _filePath, job.format, errorString);
+                    QMutexLocker locker(&d->mutex);
+                    if(ok && skipUnchangedWrites)
+                        d->writtenHashes.insert(_filePath, hash);
+                    else
+                        d->writtenHashes.remove(_filePath);
+                }
+                for(QFutureInterface<bool> &future : job.futures) {
+                    future.reportResult(ok);
+                    future.reportFinished();
+                }
+                emit _writer->finished(_filePath, ok, errorString);
+            }
+        }
+        
+    private:
+        AsyncWriter *_writer;
+        QString _filePath;
+    };
+    
+    AsyncWriter::AsyncWriter(QObject *parent) : QObject(parent), d(new Private)
+    {
+    }
+    
+    AsyncWriter::~AsyncWriter()
+    {
+        d->pool.waitForDone();
+        delete d;
+    }
+    
+    QFuture<bool> AsyncWriter::writeJson(QObject *object, const QString &filePath, int childDepth, bool includeReadOnlyProperties, QJsonDocument::JsonFormat format)
+    {
+        return enqueue(serialize(object, childDepth, includeReadOnlyProperties), filePath, format);
+    }
+    
+    QFuture<bool> AsyncWriter::writeJson(const QVariantMap &data, const QString &filePath, QJsonDocument::JsonFormat format)
+    {
+        return enqueue(data, filePath, format);
+    }
+    
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    QFuture<bool> AsyncWriter::writeCbor(QObject *object, const QString &filePath, int childDepth, bool includeReadOnlyProperties)
+    {
+        return enqueue(serialize(object, childDepth, includeReadOnlyProperties), filePath, CborFormat);
+    }
+    
+    QFuture<bool> AsyncWriter::writeCbor(const QVariantMap &data, const QString &filePath)
+    {
+        return enqueue(data, filePath, CborFormat);
+    }
+#endif
+    
+    void AsyncWriter::waitForFinished()
+    {
+        d->pool.waitForDone();
+    }
+    
+    void AsyncWriter::setSkipUnchangedWrites(bool skip)
+    {
+        QMutexLocker locker(&d->mutex);
+        d->skipUnchangedWrites = skip;
+        if(!skip)
+            d->writtenHashes.clear();
+    }
+    
+    QFuture<bool> AsyncWriter::enqueue(const QVariantMap &data, const QString &filePath, int format)
+    {
+        QFutureInterface<bool> future;
+        future.reportStarted();
+        QMutexLocker locker(&d->mutex);
+        // Replace any pending (i.e. not yet started) job for the same file.
+        Private::Job &job = d->pendingJobs[filePath];
+        job.data = data;
+        job.format = format;
+        job.futures.append(future);
+        if(!d->activeFiles.contains(filePath)) {
+            d->activeFiles.insert(filePath);
+            d->pool.start(new AsyncWriterTask(this, filePath));
+        }
+        return future.future();
+    }
+    
+    /* --------------------------------------------------------------------------------
+     * ChangeTracker
+     * -------------------------------------------------------------------------------- */
+    struct ChangeTracker::Private
+    {
+        struct Node
+        {
+            QObject *parent; // NULL for the root.
+            QObjectList children; // Tracked children.
+            QVariantMap properties; // Cached property data.
+            QVariantMap data; // Cached property and child data.
+            QByteArray hash; // Cached contentHash() of data.
+            bool propertiesDirty;
+            bool childrenDirty;
+            // Cached data (hash) is out of date. If a node is dirty, so are all of its ancestors.
+            bool dirty;
+            bool hashDirty;
+            
+            Node() : parent(NULL), propertiesDirty(true), childrenDirty(true), dirty(true), hashDirty(true) {}
+        };
+        
+        QObject *root;
+        bool includeReadOnlyProperties;
+        QHash<QObject*, Node*> nodes;
+        
+        Private() : root(NULL), includeReadOnlyProperties(true) {}
+        
+        // Mark node and all of its ancestors as dirty.
+        void invalidate(Node *node)
+        {
+            while(node && !(node->dirty && node->hashDirty)) {
+                node->dirty = true;
+                node->hashDirty = true;
+                node = nodes.value(node->parent);
+            }
+        }
+    };
+    
+    ChangeTracker::ChangeTracker(QObject *parent) : QObject(parent), d(new Private)
+    {
+    }
+    
+    ChangeTracker::~ChangeTracker()
+    {
+        untrack();
+        delete d;
+    }
+    
+    void ChangeTracker::track(QObject *root, bool includeReadOnlyProperties)
+    {
+        untrack();
+        if(!root)
+            return;
+        d->root = root;
+        d->includeReadOnlyProperties = includeReadOnlyProperties;
+        attach(root, NULL);
+    }
+    
+    void ChangeTracker::untrack()
+    {
+        for(QHash<QObject*, Private::Node*>::const_iterator i = d->nodes.constBegin(); i != d->nodes.constEnd(); ++i) {
+            disconnect(i.key(), 0, this, 0);
+            i.key()->removeEventFilter(this);
+            delete i.value();
+        }
+        d->nodes.clear();
+        d->root = NULL;
+    }
+    
+    QObject* ChangeTracker::root() const
+    {
+        return d->root;
+    }
+    
+    QVariantMap ChangeTracker::serialize()
+    {
+        return d->root ? rebuild(d->root) : QVariantMap();
+    }
+    
+    bool ChangeTracker::isDirty() const
+    {
+        Private::Node *node = d->nodes.value(d->root);
+        return node && node->dirty;
+    }
+    
+    QByteArray ChangeTracker::hash()
+    {
+        return d->root ? rehash(d->root) : contentHash(QVariantMap());
+    }
+    
+    void ChangeTracker::markDirty(QObject *object)
+    {
+        if(Private::Node *node = d->nodes.value(object)) {
+            node->propertiesDirty = true;
+            d->invalidate(node);
+        }
+    }
+    
+    bool ChangeTracker::eventFilter(QObject *watched, QEvent *event)
+    {
+        switch(event->type()) {
+            case QEvent::DynamicPropertyChange:
+                markDirty(watched);
+                break;
+            case QEvent::ChildAdded:
+            case QEvent::ChildRemoved:
+                if(Private::Node *node = d->nodes.value(watched)) {
+                    if(event->type() == QEvent::ChildRemoved) {
+                        // The child may have been reparented elsewhere, in which case we stop watching it.
+                        QObject *child = static_cast<QChildEvent*>(event)->child();
+                        if(d->nodes.contains(child))
+                            detach(child, true);
+                    }
+                    // Children are (re)attached on the next serialize() as newly added children may not be fully constructed yet.
+                    node->childrenDirty = true;
+                    d->invalidate(node);
+                }
+                break;
+            default:
+                break;
+        }
+        return QObject::eventFilter(watched, event);
+    }
+    
+    void ChangeTracker::onPropertyChanged()
+    {
+        markDirty(sender());
+    }
+    
+    void ChangeTracker::onDestroyed(QObject *object)
+    {
+        Private::Node *node = d->nodes.value(object);
+        if(!node)
+            return;
+        if(object == d->root) {
+            untrack();
+            return;
+        }
+        Private::Node *parentNode = d->nodes.value(node->parent);
+        detach(object, false);
+        if(parentNode) {
+            parentNode->childrenDirty = true;
+            d->invalidate(parentNode);
+        }
+    }
+    
+    void ChangeTracker::attach(QObject *object, QObject *parent)
+    {
+        Private::Node *node = new Private::Node;
+        node->parent = parent;
+        d->nodes.insert(object, node);
+        // Watch for property changes.
+        static const QMetaMethod onPropertyChangedSlot = staticMetaObject.method(staticMetaObject.indexOfSlot("onPropertyChanged()"));
+        const PropertyPlanPointer plan = propertyPlan(object->metaObject());
+        const QVector<int> &propertyIndexes = d->includeReadOnlyProperties ? plan->readableIndexes : plan->readWriteIndexes;
+        for(int index : propertyIndexes) {
+            const QMetaProperty &metaProperty = plan->properties.at(index);
+            if(metaProperty.hasNotifySignal())
+                connect(object, metaProperty.notifySignal(), this, onPropertyChangedSlot, Qt::UniqueConnection);
+        }
+        connect(object, &QObject::destroyed, this, &ChangeTracker::onDestroyed, Qt::UniqueConnection);
+        // Watch for dynamic property changes and added/removed children.
+        object->installEventFilter(this);
+    }
+    
+    void ChangeTracker::detach(QObject *object, bool isAlive)
+    {
+        Private::Node *node = d->nodes.take(object);
+        if(!node)
+            return;
+        for(QObject *child : node->children)
+            detach(child, isAlive);
+        if(isAlive) {
+            disconnect(object, 0, this, 0);
+            object->removeEventFilter(this);
+        }
+        delete node;
+    }
+    
+    void ChangeTracker::refresh(QObject *object)
+    {
+        Private::Node *node = d->nodes.value(object);
+        if(node->propertiesDirty) {
+            node->properties.clear();
+            addPropertyData(node->properties, object, d->includeReadOnlyProperties);
+            node->propertiesDirty = false;
+        }
+        if(node->childrenDirty) {
+            // Attach new children and detach removed ones.
+            const QObjectList children = object->children();
+            QSet<QObject*> current;
+            current.reserve(children.size());
+            for(QObject *child : children) {
+                current.insert(child);
+                if(!d->nodes.contains(child))
+                    attach(child, object);
+            }
+            for(QObject *child : node->children) {
+                if(!current.contains(child))
+                    detach(child, true);
+            }
+            node->children = children;
+            node->childrenDirty = false;
+        }
+    }
+    
+    QVariantMap ChangeTracker::rebuild(QObject *object)
+    {
+        Private::Node *node = d->nodes.value(object);
+        if(!node->dirty)
+            return node->data;
+        refresh(object);
+        QVariantMap data = node->properties;
+        addChildData(data, node->children, [this](QObject *child) { return rebuild(child); });
+        node->data = data;
+        node->dirty = false;
+        return data;
+    }
+    
+    QByteArray ChangeTracker::rehash(QObject *object)
+    {
+        Private::Node *node = d->nodes.value(object);
+        if(!node->hashDirty)
+            return node->hash;
+        refresh(object);
+        // Child hashes grouped by class name as in addChildData().
+        QMap<QString, QList<QByteArray> > childHashes;
+        bool hasKeyCollision = false;
+        for(QObject *child : node->children) {
+            const QString className = QString::fromUtf8(child->metaObject()->className());
+            childHashes[className].append(rehash(child));
+            hasKeyCollision = hasKeyCollision || node->properties.contains(className);
+        }
+        if(hasKeyCollision) {
+            // Properties and children are merged into lists, so hash the merged data.
+            node->hash = hashMap(rebuild(object));
+        } else {
+            // Same as hashMap() of the serialized data, with the children's cached hashes standing in for their maps.
+            QCryptographicHash hash(HashAlgorithm);
+            hash.addData("M", 1);
+            QVariantMap::const_iterator property = node->properties.constBegin();
+            QMap<QString, QList<QByteArray> >::const_iterator group = childHashes.constBegin();
+            while(property != node->properties.constEnd() || group != childHashes.constEnd()) {
+                if(group == childHashes.constEnd() || (property != node->properties.constEnd() && property.key() < group.key())) {
+                    addKeyToHash(hash, property.key());
+                    addValueToHash(hash, property.value());
+                    ++property;
+                } else {
+                    addKeyToHash(hash, group.key());
+                    if(group.value().size() == 1) {
+                        hash.addData(group.value().first());
+                    } else {
+                        QCryptographicHash listHash(HashAlgorithm);
+                        listHash.addData("L", 1);
+                        for(const QByteArray &childHash : group.value())
+                            listHash.addData(childHash);
+                        hash.addData(listHash.result());
+                    }
+                    ++group;
+                }
+            }
+            node->hash = hash.result();
+        }
+        node->hashDirty = false;
+        return node->hash;
+    }
+    
+    /* --------------------------------------------------------------------------------
+     * Diff/Patch
+     * -------------------------------------------------------------------------------- */
+    namespace
+    {
+        // Serialized object split into its properties and its groups of child maps.
+        struct ObjectEntries
+        {
+            QVariantMap properties;
+            QMap<QString, QVariantList> children;
+            
+            explicit ObjectEntries(const QVariantMap &data)
+            {
+                for(QVariantMap::const_iterator i = data.constBegin(); i != data.constEnd(); ++i) {
+                    if(i.value().type() == QVariant::Map) {
+                        children[i.key()].append(i.value());
+                    } else if(i.value().type() == QVariant::List) {
+                        // List of child objects and/or property values.
+                        const QVariantList list = i.value().toList();
+                        QVariantList childList;
+                        QVariantList values;
+                        for(const QVariant &value : list) {
+                            if(value.type() == QVariant::Map)
+                                childList.append(value);
+                            else
+                                values.append(value);
+                        }
+                        if(childList.isEmpty()) {
+                            properties.insert(i.key(), i.value());
+                            continue;
+                        }
+                        children.insert(i.key(), childList);
+                        if(!values.isEmpty())
+                            properties.insert(i.key(), values.size() == 1 ? values.first() : QVariant(values));
+                    } else {
+                        properties.insert(i.key(), i.value());
+                    }
+                }
+            }
+        };
+        
+        QString objectNameOfChild(const QVariant &childData)
+        {
+            const QVariantMap data = childData.toMap();
+            const QVariant *objectName = objectNameOf(data);
+            return objectName ? objectName->toString() : QString();
+        }
+        
+        // Match new children to old children of the same class as matchChild() does for list entries:
+        // by objectName if possible, otherwise to the next unnamed old child.
+        // Returns the index of the matching old child (or -1) for each new child.
+        QVector<int> matchChildData(const QVariantList &oldChildren, const QVariantList &newChildren)
+        {
+            QHash<QString, QList<int> > namedOldChildren;
+            QList<int> unnamedOldChildren;
+            for(int i = 0; i < oldChildren.size(); ++i) {
+                const QString objectName = objectNameOfChild(oldChildren.at(i));
+                if(objectName.isEmpty())
+                    unnamedOldChildren.append(i);
+                else
+                    namedOldChildren[objectName].append(i);
+            }
+            QVector<int> matches(newChildren.size(), -1);
+            for(int j = 0; j < newChildren.size(); ++j) {
+                const QString objectName = objectNameOfChild(newChildren.at(j));
+                if(!objectName.isEmpty()) {
+                    QHash<QString, QList<int> >::iterator named = namedOldChildren.find(objectName);
+                    if(named != namedOldChildren.end() && !named->isEmpty()) {
+                        matches[j] = named->takeFirst();
+                        continue;
+                    }
+                }
+                if(!unnamedOldChildren.isEmpty())
+                    matches[j] = unnamedOldChildren.takeFirst();
+            }
+            return matches;
+        }
+        
+        PatchOperation patchOperation(PatchOperation::Type type, const QList<PatchOperation::PathElement> &path, const QString &name, const QVariant &value = QVariant(), int index = -1)
+        {
+            PatchOperation operation;
+            operation.type = type;
+            operation.path = path;
+            operation.name = name.toUtf8();
+            operation.value = value;
+            operation.index = index;
+            return operation;
+        }
+        
+        // Append the operations that turn oldData into newData for the object at path.
+        // All changes inside matched children come before any children are removed or added,
+        // so that paths always refer to the child indexes in the unpatched tree.
+        void diffObject(const QVariantMap &oldData, const QVariantMap &newData, const QList<PatchOperation::PathElement> &path, Patch &patch)
+        {
+            // Unchanged subtrees are often shared (e.g. from ChangeTracker).
+            if(oldData.isSharedWith(newData))
+                return;
+            const ObjectEntries oldEntries(oldData);
+            const ObjectEntries newEntries(newData);
+            // Properties.
+            for(QVariantMap::const_iterator i = newEntries.properties.constBegin(); i != newEntries.properties.constEnd(); ++i) {
+                QVariantMap::const_iterator old = oldEntries.properties.constFind(i.key());
+                if(old == oldEntries.properties.constEnd() || old.value() != i.value())
+                    patch.append(patchOperation(PatchOperation::SetProperty, path, i.key(), i.value()));
+            }
+            for(QVariantMap::const_iterator i = oldEntries.properties.constBegin(); i != oldEntries.properties.constEnd(); ++i) {
+                if(!newEntries.properties.contains(i.key()))
+                    patch.append(patchOperation(PatchOperation::RemoveProperty, path, i.key()));
+            }
+            // Children.
+            QStringList classNames = oldEntries.children.keys();
+            for(QMap<QString, QVariantList>::const_iterator i = newEntries.children.constBegin(); i != newEntries.children.constEnd(); ++i) {
+                if(!oldEntries.children.contains(i.key()))
+                    classNames.append(i.key());
+            }
+            Patch structuralChanges;
+            for(const QString &className : classNames) {
+                const QVariantList oldChildren = oldEntries.children.value(className);
+                const QVariantList newChildren = newEntries.children.value(className);
+                const QVector<int> matches = matchChildData(oldChildren, newChildren);
+                QVector<int> matchOfOldChild(oldChildren.size(), -1);
+                for(int j = 0; j < matches.size(); ++j) {
+                    if(matches.at(j) != -1)
+                        matchOfOldChild[matches.at(j)] = j;
+                }
+                QList<PatchOperation::PathElement> childPath = path;
+                childPath.append(PatchOperation::PathElement(className.toUtf8(), 0));
+                for(int i = 0; i < oldChildren.size(); ++i) {
+                    if(matchOfOldChild.at(i) == -1)
+                        continue;
+                    childPath.last().second = i;
+                    diffObject(oldChildren.at(i).toMap(), newChildren.at(matchOfOldChild.at(i)).toMap(), childPath, patch);
+                }
+                // Remove from the back so the remaining indexes stay valid.
+                for(int i = oldChildren.size() - 1; i >= 0; --i) {
+                    if(matchOfOldChild.at(i) == -1)
+                        structuralChanges.append(patchOperation(PatchOperation::RemoveChild, path, className, QVariant(), i));
+                }
+                // Build the new order front to back. current holds the new index of each remaining child.
+                QList<int> current;
+                for(int i = 0; i < oldChildren.size(); ++i) {
+                    if(matchOfOldChild.at(i) != -1)
+                        current.append(matchOfOldChild.at(i));
+                }
+                for(int j = 0; j < newChildren.size(); ++j) {
+                    if(matches.at(j) == -1) {
+                        structuralChanges.append(patchOperation(PatchOperation::AddChild, path, className, newChildren.at(j), j));
+                        current.insert(j, j);
+                        continue;
+                    }
+                    // Children before j are already in place, so a moved child is always after j.
+                    const int from = current.indexOf(j, j);
+                    if(from != j) {
+                        PatchOperation move = patchOperation(PatchOperation::MoveChild, path, className, QVariant(), j);
+                        move.fromIndex = from;
+                        structuralChanges.append(move);
+                        current.move(from, j);
+                    }
+                }
+            }
+            patch.append(structuralChanges);
+        }
+        
+        /* --------------------------------------------------------------------------------
+         * Resolves patch paths in an object tree.
+         * Each visited object's children are grouped by className once,
+         * and the groups are kept up to date as the patch adds and removes children.
+         * -------------------------------------------------------------------------------- */
+        class PatchTargets
+        {
+        public:
+            explicit PatchTargets(QObject *root) : _root(root) {}
+            
+            QObject* resolve(const QList<PatchOperation::PathElement> &path)
+            {
+                QObject *object = _root;
+                for(const PatchOperation::PathElement &element : path) {
+                    object = child(object, element.first, element.second);
+                    if(!object)
+                        return NULL;
+                }
+                return object;
+            }
+            
+            int childCount(QObject *parent, const QByteArray &className)
+            {
+                return children(parent)[className].size();
+            }
+            
+            QObject* child(QObject *parent, const QByteArray &className, int index)
+            {
+                const QObjectList &group = children(parent)[className];
+                return index >= 0 && index < group.size() ? group.at(index) : NULL;
+            }
+            
+            // Call after child was added to parent.
+            void childAdded(QObject *parent, QObject *child)
+            {
+                QHash<QObject*, ClassChildren>::iterator it = _children.find(parent);
+                if(it != _children.end())
+                    (*it)[QByteArray(child->metaObject()->className())].append(child);
+            }
+            
+            // Move the child at index from to index to among parent's children of className.
+            // QObject children cannot be reordered in place, so the group's children from the first
+            // changed index on are re-appended to parent in their new order. The relative order of
+            // children of different classes is not serialized and may change.
+            void moveChild(QObject *parent, const QByteArray &className, int from, int to)
+            {
+                QObjectList &group = children(parent)[className];
+                if(from < 0 || from >= group.size() || to < 0 || to >= group.size() || from == to)
+                    return;
+                group.move(from, to);
+                for(int i = qMin(from, to); i < group.size(); ++i) {
+                    QObject *child = group.at(i);
+                    child->setParent(NULL);
+                    child->setParent(parent);
+                }
+            }
+            
+            // Call before child of parent is deleted.
+            void childRemoved(QObject *parent, QObject *child, const QByteArray &className, int index)
+            {
+                QHash<QObject*, ClassChildren>::iterator it = _children.find(parent);
+                if(it != _children.end())
+                    (*it)[className].removeAt(index);
+                // Deleted objects' addresses may be reused by objects created later.
+                _children.remove(child);
+                foreach(QObject *descendant, child->findChildren<QObject*>())
+                    _children.remove(descendant);
+            }
+            
+        private:
+            typedef QHash<QByteArray, QObjectList> ClassChildren;
+            
+            ClassChildren& children(QObject *parent)
+            {
+                QHash<QObject*, ClassChildren>::iterator it = _children.find(parent);
+                if(it == _children.end()) {
+                    it = _children.insert(parent, ClassChildren());
+                    foreach(QObject *child, parent->children())
+                        (*it)[QByteArray(child->metaObject()->className())].append(child);
+                }
+                return *it;
+            }
+            
+            QObject *_root;
+            QHash<QObject*, ClassChildren> _children;
+        };
+        
+        const char * const patchOperationNames[] = { "setProperty", "removeProperty", "addChild", "removeChild", "moveChild" };
+        const int numPatchOperationTypes = int(sizeof(patchOperationNames) / sizeof(patchOperationNames[0]));
+    } // anonymous namespace
+    
+    Patch diff(const QVariantMap &oldData, const QVariantMap &newData)
+    {
+        Patch patch;
+        diffObject(oldData, newData, QList<PatchOperation::PathElement>(), patch);
+        return patch;
+    }
+    
+    void applyPatch(QObject *object, const Patch &patch, ObjectFactory *factory)
+    {
+        if(!object)
+            return;
+        PatchTargets targets(object);
+        const DeserializeContext context(factory);
+        for(const PatchOperation &operation : patch) {
+            QObject *target = targets.resolve(operation.path);
+            if(!target)
+                continue;
+            switch(operation.type) {
+                case PatchOperation::SetProperty: {
+                    // Binary arrays stay maps in patches that were read from JSON.
+                    QVariant value = operation.value;
+                    if(value.type() == QVariant::Map)
+                        readBinaryValue(value.toMap(), value);
+                    writeProperty(target, *propertyPlan(target->metaObject()), QString::fromUtf8(operation.name), value, context);
+                    break;
+                }
+                case PatchOperation::RemoveProperty:
+                    // Removes dynamic properties. Static properties cannot be removed, and are left as they are
+                    // rather than reset (e.g. diff() of a selection or of values that cannot be serialized).
+                    if(target->metaObject()->indexOfProperty(operation.name.constData()) < 0)
+                        target->setProperty(operation.name.constData(), QVariant());
+                    break;
+                case PatchOperation::AddChild:
+                    if(QObject *child = createChild(target, operation.name, factory)) {
+                        targets.childAdded(target, child);
+                        deserializeObject(child, operation.value.toMap(), context);
+                        // Added children are appended, so move them into place.
+                        const int last = targets.childCount(target, operation.name) - 1;
+                        if(operation.index >= 0 && operation.index < last)
+                            targets.moveChild(target, operation.name, last, operation.index);
+                    }
+                    break;
+                case PatchOperation::MoveChild:
+                    targets.moveChild(target, operation.name, operation.fromIndex, operation.index);
+                    break;
+                case PatchOperation::RemoveChild:
+                    if(QObject *child = targets.child(target, operation.name, operation.index)) {
+                        targets.childRemoved(target, child, operation.name, operation.index);
+                        delete child;
+                    }
+                    break;
+            }
+        }
+    }
+    
+    QVariantList patchToVariant(const Patch &patch)
+    {
+        QVariantList data;
+        data.reserve(patch.size());
+        for(const PatchOperation &operation : patch) {
+            QVariantMap operationData;
+            operationData["op"] = QString::fromUtf8(patchOperationNames[operation.type]);
+            if(!operation.path.isEmpty()) {
+                // Flattened (className, index) pairs.
+                QVariantList path;
+                path.reserve(2 * operation.path.size());
+                for(const PatchOperation::PathElement &element : operation.path) {
+                    path.append(QString::fromUtf8(element.first));
+                    path.append(element.second);
+                }
+                operationData["path"] = path;
+            }
+            operationData["name"] = QString::fromUtf8(operation.name);
+            if(operation.type == PatchOperation::SetProperty || operation.type == PatchOperation::AddChild)
+                operationData["value"] = operation.value;
+            if(operation.index != -1)
+                operationData["index"] = operation.index;
+            if(operation.type == PatchOperation::MoveChild)
+                operationData["from"] = operation.fromIndex;
+            data.append(operationData);
+        }
+        return data;
+    }
+    
+    Patch patchFromVariant(const QVariantList &data)
+    {
+        Patch patch;
+        patch.reserve(data.size());
+        for(const QVariant &operationValue : data) {
+            const QVariantMap operationData = operationValue.toMap();
+            PatchOperation operation;
+            const QString op = operationData.value("op").toString();
+            int type = 0;
+            while(type < numPatchOperationTypes && op != QLatin1String(patchOperationNames[type]))
+                ++type;
+            if(type == numPatchOperationTypes)
+                throw std::runtime_error("QtPropertySerializer::patchFromVariant: Unknown operation " + op.toStdString());
+            operation.type = PatchOperation::Type(type);
+            const QVariantList path = operationData.value("path").toList();
+            for(int i = 0; i + 1 < path.size(); i += 2)
+                operation.path.append(PatchOperation::PathElement(path.at(i).toString().toUtf8(), path.at(i + 1).toInt()));
+            operation.name = operationData.value("name").toString().toUtf8();
+            operation.value = operationData.value("value");
+            operation.index = operationData.value("index", -1).toInt();
+            operation.fromIndex = operationData.value("from", -1).toInt();
+            patch.append(operation);
+        }
+        return patch;
+    }
+    
+    /* --------------------------------------------------------------------------------
+     * Journal
+     * -------------------------------------------------------------------------------- */
+    namespace
+    {
+        // Journal records, one per line:
+        //   {"snapshot": hash} Header naming the SHA-1 (hex) of the snapshot file that the journal applies to.
+        //   {"patch": patchToVariant(patch)} A save.
+        //   {"compact": true} A compaction started here. Its snapshot holds everything before this record.
+        QByteArray journalRecord(const QString &key, const QVariant &value)
+        {
+            QVariantMap record;
+            record.insert(key, value);
+            QBuffer buffer;
+            buffer.open(QIODevice::WriteOnly);
+            writeJson(record, &buffer, QJsonDocument::Compact);
+            // Compact JSON escapes newlines within strings.
+            return buffer.data() + '\n';
+        }
+        
+        QString snapshotHash(const QByteArray &snapshot)
+        {
+            return QString::fromLatin1(QCryptographicHash::hash(snapshot, HashAlgorithm).toHex());
+        }
+        
+        // Write bytes to filePath, atomically replacing any existing file.
+        bool replaceFile(const QString &filePath, const QByteArray &bytes, QString &errorString)
+        {
+            QSaveFile file(filePath);
+            if(!file.open(QIODevice::WriteOnly) || file.write(bytes) != bytes.size() || !file.commit()) {
+                errorString = file.errorString();
+                return false;
+            }
+            return true;
+        }
+        
+        // Apply the journal's saves to object, which holds the snapshot.
+        // Returns false if the files need to be rewritten, i.e. if the journal is missing, ends in
+        // a torn record, or belongs to an older snapshot.
+        bool replayJournal(QObject *object, const QByteArray &journal, const QString &hash, ObjectFactory *factory)
+        {
+            bool ok = true;
+            QList<QVariantMap> records;
+            foreach(const QByteArray &line, journal.split('\n')) {
+                if(line.isEmpty())
+                    continue;
+                QJsonParseError error;
+                const QJsonDocument document = QJsonDocument::fromJson(line, &error);
+                if(error.error != QJsonParseError::NoError || !document.isObject()) {
+                    // e.g. the last save was cut short by a crash.
+                    ok = false;
+                    break;
+                }
+                records.append(document.object().toVariantMap());
+            }
+            if(records.isEmpty() || records.first().value("snapshot").toString() != hash) {
+                // A compaction replaced the snapshot but not the journal,
+                // so only the saves after its compaction record are newer than the snapshot.
+                int compaction = records.size() - 1;
+                while(compaction >= 0 && !records.at(compaction).contains("compact"))
+                    --compaction;
+                if(compaction == -1)
+                    return false;
+                records = records.mid(compaction + 1);
+                ok = false;
+            }
+            for(const QVariantMap &record : records) {
+                if(record.contains("patch"))
+                    applyPatch(object, patchFromVariant(record.value("patch").toList()), factory);
+            }
+            return ok;
+        }
+    } // anonymous namespace
+    
+    struct Journal::Private
+    {
+        QPointer<QObject> object;
+        QString filePath;
+        bool includeReadOnlyProperties;
+        QJsonDocument::JsonFormat format;
+        qint64 compactThreshold;
+        // Data that the snapshot and journal add up to.
+        QVariantMap data;
+        
+        QMutex mutex; // Guards journal and isCompacting.
+        QFile journal; // Open for appending.
+        bool isCompacting;
+        QThreadPool pool;
+        
+        Private() : includeReadOnlyProperties(true), format(QJsonDocument::Indented), compactThreshold(1024 * 1024), isCompacting(false)
+        {
+            pool.setMaxThreadCount(1);
+        }
+        
+        QString journalPath() const { return filePath + ".journal"; }
+        
+        // Call with mutex locked.
+        void append(const QByteArray &record)
+        {
+            if(journal.write(record) != record.size() || !journal.flush())
+                throw std::runtime_error("QtPropertySerializer::Journal: Failed to write file " + journalPath().toStdString() + ": " + journal.errorString().toStdString());
+        }
+        
+        // Write data as the snapshot, then replace the journal with a header for the new snapshot
+        // followed by the journal's records from tailOffset on (none if -1).
+        bool writeSnapshot(const QVariantMap &snapshotData, qint64 tailOffset, QString &errorString)
+        {
+            QBuffer buffer;
+            buffer.open(QIODevice::WriteOnly);
+            try {
+                writeJson(snapshotData, &buffer, format);
+            } catch(const std::exception &e) {
+                errorString = QString::fromUtf8(e.what());
+                return false;
+            }
+            if(!replaceFile(filePath, buffer.data(), errorString))
+                return false;
+            QMutexLocker locker(&mutex);
+            QByteArray journalBytes = journalRecord("snapshot", snapshotHash(buffer.data()));
+            if(tailOffset >= 0) {
+                QFile file(journalPath());
+                if(!file.open(QIODevice::ReadOnly) || !file.seek(tailOffset)) {
+                    errorString = file.errorString();
+                    return false;
+                }
+                journalBytes += file.readAll();
+            }
+            journal.close();
+            const bool ok = replaceFile(journalPath(), journalBytes, errorString);
+            journal.setFileName(journalPath());
+            if(!journal.open(QIODevice::WriteOnly | QIODevice::Append)) {
+                errorString = journal.errorString();
+                return false;
+            }
+            return ok;
+        }
+    };
+    
+    // Worker that writes a new snapshot and cuts down the journal.
+    class JournalCompactionTask : public QRunnable
+    {
+    public:
+        JournalCompactionTask(Journal *journal, const QVariantMap &data, qint64 tailOffset) : _journal(journal), _data(data), _tailOffset(tailOffset) {}
+        
+        void run() override
+        {
+            Journal::Private *d = _journal->d;
+            QString errorString;
+            const bool ok = d->writeSnapshot(_data, _tailOffset, errorString);
+            {
+                QMutexLocker locker(&d->mutex);
+                d->isCompacting = false;
+            }
+            emit _journal->compacted(ok, errorString);
+        }
+        
+    private:
+        Journal *_journal;
+        QVariantMap _data;
+        qint64 _tailOffset;
+    };
+    
+    Journal::Journal(QObject *parent) : QObject(parent), d(new Private)
+    {
+    }
+    
+    Journal::~Journal()
+    {
+        close();
+        delete d;
+    }
+    
+    void Journal::open(QObject *object, const QString &filePath, ObjectFactory *factory, bool includeReadOnlyProperties, QJsonDocument::JsonFormat format)
+    {
+        close();
+        if(!object)
+            return;
+        bool isConsistent = false;
+        if(QFile::exists(filePath)) {
+            QFile snapshotFile(filePath);
+            if(!snapshotFile.open(QIODevice::ReadOnly))
+                throw std::runtime_error("QtPropertySerializer::Journal::open: Failed to open file " + filePath.toStdString());
+            QBuffer buffer;
+            buffer.setData(snapshotFile.readAll());
+            buffer.open(QIODevice::ReadOnly);
+            readJson(object, &buffer, factory);
+            QFile journalFile(filePath + ".journal");
+            const QByteArray journal = journalFile.open(QIODevice::ReadOnly) ? journalFile.readAll() : QByteArray();
+            isConsistent = replayJournal(object, journal, snapshotHash(buffer.data()), factory);
+        }
+        d->object = object;
+        d->filePath = filePath;
+        d->includeReadOnlyProperties = includeReadOnlyProperties;
+        d->format = format;
+        d->data = serialize(object, -1, includeReadOnlyProperties);
+        QString errorString;
+        if(isConsistent) {
+            d->journal.setFileName(d->journalPath());
+            if(d->journal.open(QIODevice::WriteOnly | QIODevice::Append))
+                return;
+            errorString = d->journal.errorString();
+        } else if(d->writeSnapshot(d->data, -1, errorString)) {
+            // First snapshot, or recovered files.
+            return;
+        }
+        close();
+        throw std::runtime_error("QtPropertySerializer::Journal::open: Failed to write file " + filePath.toStdString() + ": " + errorString.toStdString());
+    }
+    
+    void Journal::close()
+    {
+        d->pool.waitForDone();
+        d->journal.close();
+        d->object = NULL;
+        d->filePath.clear();
+        d->data.clear();
+    }
+    
+    QString Journal::filePath() const
+    {
+        return d->filePath;
+    }
+    
+    bool Journal::save()
+    {
+        if(!d->object)
+            throw std::runtime_error("QtPropertySerializer::Journal::save: No object");
+        return save(serialize(d->object, -1, d->includeReadOnlyProperties));
+    }
+    
+    bool Journal::save(const QVariantMap &data)
+    {
+        if(d->filePath.isEmpty())
+            throw std::runtime_error("QtPropertySerializer::Journal::save: No open file");
+        const Patch patch = diff(d->data, data);
+        if(patch.isEmpty())
+            return false;
+        const QByteArray record = journalRecord("patch", patchToVariant(patch));
+        qint64 size;
+        {
+            QMutexLocker locker(&d->mutex);
+            d->append(record);
+            size = d->journal.size();
+        }
+        d->data = data;
+        if(size > d->compactThreshold)
+            compact();
+        return true;
+    }
+    
+    qint64 Journal::journalSize() const
+    {
+        QMutexLocker locker(&d->mutex);
+        return d->journal.isOpen() ? d->journal.size() : 0;
+    }
+    
+    qint64 Journal::compactThreshold() const
+    {
+        return d->compactThreshold;
+    }
+    
+    void Journal::setCompactThreshold(qint64 bytes)
+    {
+        d->compactThreshold = bytes;
+    }
+    
+    void Journal::compact()
+    {
+        if(d->filePath.isEmpty())
+            return;
+        QMutexLocker locker(&d->mutex);
+        if(d->isCompacting)
+            return;
+        // Saves after this record are not in the new snapshot.
+        d->append(journalRecord("compact", true));
+        d->isCompacting = true;
+        d->pool.start(new JournalCompactionTask(this, d->data, d->journal.size()));
+    }
+    
+    void Journal::waitForCompaction()
+    {
+        d->pool.waitForDone();
+    }
+    
+    /* --------------------------------------------------------------------------------
+     * Selector
+     * -------------------------------------------------------------------------------- */
+    Selector::Pattern::Pattern(const QString &text) : text(text), isAny(text == QLatin1String("*")), isExact(true)
+    {
+        if(!isAny && (text.contains('*') || text.contains('?') || text.contains('['))) {
+            isExact = false;
+            regExp = QRegExp(text, Qt::CaseSensitive, QRegExp::Wildcard);
+        }
+    }
+    
+    Selector& Selector::add(const QString &path)
+    {
+        const QStringList segments = path.split('/', QString::SkipEmptyParts);
+        if(segments.isEmpty())
+            throw std::runtime_error("QtPropertySerializer::Selector: Empty path");
+        QVector<Step> steps;
+        for(int i = 0; i < segments.size() - 1; ++i) {
+            const QString &segment = segments.at(i);
+            Step step;
+            if(segment == QLatin1String("**")) {
+                step.kind = Step::Descendants;
+            } else {
+                QString className = segment;
+                const int open = segment.indexOf('[');
+                if(open != -1) {
+                    if(!segment.endsWith(']'))
+                        throw std::runtime_error("QtPropertySerializer::Selector: Invalid path " + path.toStdString());
+                    className = segment.left(open);
+                    step.name = Pattern(segment.mid(open + 1, segment.size() - open - 2));
+                }
+                if(className != QLatin1String("*"))
+                    step.className = className.toUtf8();
+            }
+            steps.append(step);
+        }
+        Step property;
+        property.kind = Step::Property;
+        property.name = Pattern(segments.last());
+        steps.append(property);
+        _firstSteps.append(_steps.size());
+        _steps += steps;
+        return *this;
+    }
+    
+    Selector::State Selector::rootState() const
+    {
+        State state;
+        for(int step : _firstSteps)
+            addStep(state, step);
+        return state;
+    }
+    
+    Selector::State Selector::childState(const State &state, const QByteArray &className, const QString &objectName) const
+    {
+        State childState;
+        for(int i : state) {
+            const Step &step = _steps.at(i);
+            if(step.kind == Step::Descendants)
+                addStep(childState, i); // ** also matches the child's children.
+            else if(step.kind == Step::Child && (step.className.isEmpty() || step.className == className) && step.name.matches(objectName))
+                addStep(childState, i + 1);
+        }
+        return childState;
+    }
+    
+    bool Selector::matchesProperty(const State &state, const QString &propertyName) const
+    {
+        for(int i : state) {
+            const Step &step = _steps.at(i);
+            if(step.kind == Step::Property && step.name.matches(propertyName))
+                return true;
+        }
+        return false;
+    }
+    
+    void Selector::addStep(State &state, int step) const
+    {
+        if(state.contains(step))
+            return;
+        state.append(step);
+        if(_steps.at(step).kind == Step::Descendants)
+            addStep(state, step + 1);
+    }
+    
+    /* --------------------------------------------------------------------------------
+     * ObjectPool
+     * -------------------------------------------------------------------------------- */
+    namespace
+    {
+        // Blocks are aligned for any type and can hold the free list link.
+        std::size_t poolBlockSize(std::size_t size)
+        {
+            const std::size_t alignment = alignof(std::max_align_t);
+            size = qMax(size, sizeof(void*));
+            return (size + alignment - 1) / alignment * alignment;
+        }
+    }
+    
+    ObjectPool::ObjectPool(std::size_t blockSize) : _blockSize(poolBlockSize(blockSize)), _freeList(NULL), _chunkSize(64) {}
+    
+    void* ObjectPool::allocate()
+    {
+        QMutexLocker locker(&_mutex);
+        if(!_freeList) {
+            grow(_chunkSize);
+            // Fewer, larger chunks as the pool grows.
+            if(_chunkSize < 4096)
+                _chunkSize *= 2;
+        }
+        void *block = _freeList;
+        _freeList = *static_cast<void**>(block);
+        return block;
+    }
+    
+    QVector<void*> ObjectPool::allocate(int count)
+    {
+        QVector<void*> blocks;
+        if(count <= 0)
+            return blocks;
+        blocks.reserve(count);
+        QMutexLocker locker(&_mutex);
+        // Reserve the chunk for the rest (if any) before taking free blocks, so that nothing is lost if it throws.
+        int numFreeBlocks = 0;
+        for(void *block = _freeList; block && numFreeBlocks < count; block = *static_cast<void**>(block))
+            ++numFreeBlocks;
+        const int numChunkBlocks = count - numFreeBlocks;
+        char *chunk = numChunkBlocks ? static_cast<char*>(::operator new(numChunkBlocks * _blockSize)) : NULL;
+        for(int i = 0; i < numFreeBlocks; ++i) {
+            blocks.append(_freeList);
+            _freeList = *static_cast<void**>(_freeList);
+        }
+        for(int i = 0; i < numChunkBlocks; ++i)
+            blocks.append(chunk + i * _blockSize);
+        return blocks;
+    }
+    
+    void ObjectPool::deallocate(void *block)
+    {
+        if(!block)
+            return;
+        QMutexLocker locker(&_mutex);
+        *static_cast<void**>(block) = _freeList;
+        _freeList = block;
+    }
+    
+    void ObjectPool::grow(int count)
+    {
+        char *chunk = static_cast<char*>(::operator new(count * _blockSize));
+        for(int i = count - 1; i >= 0; --i) {
+            void *block = chunk + i * _blockSize;
+            *static_cast<void**>(block) = _freeList;
+            _freeList = block;
+        }
     }
     
 } // QtPropertySerializer
@@ -2,6 +2,21 @@
  * Tools for serializing properties in a QObject tree.
  * - Serialize/Deserialize to/from a QVariantMap.
  * - Read/Write from/to a JSON file.
+ * - Stream JSON directly to/from a QIODevice.
+ * - Read/Write from/to a compact binary CBOR file (Qt >= 5.12).
+ * - Asynchronous file writes.
+ * - Change tracking for incremental re-serialization.
+ * - Structural diff and patch between serialized trees.
+ * - Optional per-phase and per-class statistics.
+ * - Typed property bindings that bypass QMetaProperty and QVariant.
+ * - Bulk and pooled object creation.
+ * - Lazy loading of large JSON files.
+ * - Partial serialization/deserialization of selected paths.
+ * - Parallel JSON encoding of child subtrees.
+ * - Binary encoding of numeric arrays and byte arrays.
+ * - Content hashing of object subtrees.
+ * - Journaled autosave with background compaction.
+ * - Newline-delimited JSON streams of objects.
  *
  * Author: Marcel Paz Goldschen-Ohm
  * Email: marcel.goldschen@gmail.com
@@ -10,16 +25,30 @@
 #ifndef __QtPropertySerializer_H__
 #define __QtPropertySerializer_H__
 
+#include <cstddef>
 #include <functional>
+#include <type_traits>
 
 #include <QByteArray>
+#include <QEvent>
+#include <QFuture>
+#include <QHash>
+#include <QIODevice>
+#include <QJsonDocument>
 #include <QMap>
 #include <QMetaObject>
+#include <QMutex>
 #include <QObject>
+#include <QPair>
+#include <QPointer>
+#include <QRegExp>
 #include <QString>
+#include <QStringList>
+#include <QThreadPool>
 #include <QVariant>
 #include <QVariantList>
 #include <QVariantMap>
+#include <QVector>
 
 #ifdef DEBUG
 #include <iostream>
@@ -28,6 +57,66 @@
 
 namespace QtPropertySerializer
 {
+    /* --------------------------------------------------------------------------------
+     * Pool of fixed-size memory blocks for classes that are created in large numbers.
+     * Blocks are reserved in chunks and freed blocks are reused, but chunks are never
+     * returned to the system. Thread-safe.
+     * -------------------------------------------------------------------------------- */
+    class ObjectPool
+    {
+    public:
+        explicit ObjectPool(std::size_t blockSize);
+        
+        void* allocate();
+        // Allocate count blocks at once (reserved in a single chunk if the pool has too few free blocks).
+        // The pool is unchanged if reserving the chunk throws.
+        QVector<void*> allocate(int count);
+        void deallocate(void *block);
+        
+    private:
+        // Add a chunk of count blocks to the free list.
+        void grow(int count);
+        
+        QMutex _mutex;
+        std::size_t _blockSize;
+        // Singly linked list through the first bytes of each free block.
+        void *_freeList;
+        int _chunkSize;
+    };
+    
+    /* --------------------------------------------------------------------------------
+     * Derive from PooledAllocation<T> to allocate objects of class T from a per-class ObjectPool.
+     * e.g. class Pet : public QObject, public QtPropertySerializer::PooledAllocation<Pet> { ... };
+     * Objects are still deleted normally (e.g. by their parent).
+     * Subclasses of T that are larger than T use the global allocator.
+     * -------------------------------------------------------------------------------- */
+    template <class T>
+    class PooledAllocation
+    {
+    public:
+        static ObjectPool& pool()
+        {
+            // Never destroyed so that objects can outlive static destruction.
+            static ObjectPool *objectPool = new ObjectPool(sizeof(T));
+            return *objectPool;
+        }
+        
+        static void* operator new(std::size_t size) { return size == sizeof(T) ? pool().allocate() : ::operator new(size); }
+        static void operator delete(void *ptr, std::size_t size)
+        {
+            if(!ptr)
+                return;
+            if(size == sizeof(T))
+                pool().deallocate(ptr);
+            else
+                ::operator delete(ptr);
+        }
+        
+        // Construct in a block from pool().
+        static void* operator new(std::size_t, void *block) { return block; }
+        static void operator delete(void*, void*) {}
+    };
+    
     /* --------------------------------------------------------------------------------
      * Object factory for dynamic object creation during deserialization.
      * -------------------------------------------------------------------------------- */
@@ -35,10 +124,15 @@ namespace QtPropertySerializer
     {
     public:
         typedef std::function<QObject*()> ObjectCreatorFunction;
-        typedef QMap<QByteArray, ObjectCreatorFunction> ObjectCreatorMap;
+        typedef QHash<QByteArray, ObjectCreatorFunction> ObjectCreatorMap;
+        // Create count objects with the given parent at once.
+        typedef std::function<QObjectList(int count, QObject *parent)> BulkCreatorFunction;
+        typedef QHash<QByteArray, BulkCreatorFunction> BulkCreatorMap;
         
         // Map of (key,creator) pairs.
         ObjectCreatorMap creators;
+        // Optional map of (key,bulk creator) pairs used by createN().
+        BulkCreatorMap bulkCreators;
         
     public:
         // These functions are not absolutely necessary since the creators map is publicly accessible,
@@ -47,7 +141,34 @@ namespace QtPropertySerializer
         bool hasCreator(const QByteArray &key) const { return creators.contains(key); }
         ObjectCreatorFunction getCreator(const QByteArray &key) const { return creators.value(key); }
         QList<QByteArray> creatorKeys() const { return creators.keys(); }
-        QObject* create(const QByteArray &key) const { return creators.contains(key) ? creators.value(key)() : 0; }
+        QObject* create(const QByteArray &key) const
+        {
+            ObjectCreatorMap::const_iterator creator = creators.constFind(key);
+            return creator != creators.constEnd() ? creator.value()() : 0;
+        }
+        
+        // Create count objects with the given parent, using the key's bulk creator if it has one.
+        // The key is looked up once. Returns fewer objects if creation fails.
+        QObjectList createN(const QByteArray &key, int count, QObject *parent = 0) const
+        {
+            BulkCreatorMap::const_iterator bulkCreator = bulkCreators.constFind(key);
+            if(bulkCreator != bulkCreators.constEnd())
+                return bulkCreator.value()(count, parent);
+            QObjectList objects;
+            ObjectCreatorMap::const_iterator creator = creators.constFind(key);
+            if(creator == creators.constEnd())
+                return objects;
+            objects.reserve(count);
+            for(int i = 0; i < count; ++i) {
+                QObject *object = creator.value()();
+                if(!object)
+                    break;
+                if(parent)
+                    object->setParent(parent);
+                objects.append(object);
+            }
+            return objects;
+        }
         
         // For convenience. e.g. call ObjectFactory::registerCreator("MyClass", ObjectFactory::defaultCreator<MyClass>);
         // Requires T to have a default constructor T().
@@ -55,19 +176,320 @@ namespace QtPropertySerializer
         static QObject* defaultCreator() { return new T(); }
         template <class T>
         static QObject* defaultChildCreator(QObject *parent) { T *object = new T(); object->setParent(parent); return object; }
+        // Requires T to derive from PooledAllocation<T>.
+        // If a constructor throws, the objects already created are deleted and all blocks go back to the pool.
+        template <class T>
+        static QObjectList pooledBulkCreator(int count, QObject *parent)
+        {
+            // Undoes a partly created group unless dismissed.
+            struct Guard
+            {
+                const QVector<void*> &blocks;
+                QObjectList &objects;
+                bool dismissed;
+                
+                ~Guard()
+                {
+                    if(dismissed)
+                        return;
+                    // Each object's block goes back to the pool through PooledAllocation<T>::operator delete.
+                    qDeleteAll(objects);
+                    for(int i = objects.size(); i < blocks.size(); ++i)
+                        T::pool().deallocate(blocks.at(i));
+                }
+            };
+            QObjectList objects;
+            objects.reserve(count);
+            const QVector<void*> blocks = T::pool().allocate(count);
+            Guard guard = { blocks, objects, false };
+            for(void *block : blocks) {
+                T *object = new(block) T();
+                if(parent)
+                    object->setParent(parent);
+                objects.append(object);
+            }
+            guard.dismissed = true;
+            return objects;
+        }
         
         // Default creators based on className for convenience.
         template <class T>
         void registerClass() { creators[T::staticMetaObject.className()] = defaultCreator<T>; }
         template <class T>
         void registerChildClass(QObject *parent) { creators[T::staticMetaObject.className()] = std::bind(defaultChildCreator<T>, parent); }
+        // Same as registerClass() for T deriving from PooledAllocation<T>, and groups of T are allocated together.
+        template <class T>
+        void registerPooledClass() { registerClass<T>(); bulkCreators[T::staticMetaObject.className()] = pooledBulkCreator<T>; }
+    };
+    
+    /* --------------------------------------------------------------------------------
+     * Typed property bindings for hot classes.
+     * Bound properties are read and written through member pointers or getter/setter pairs
+     * instead of QMetaProperty, and the streaming encoders write bool, int, qint64, double
+     * and QString values without boxing them in a QVariant. Keys must be the names of
+     * static properties, so the data is the same as for the reflective path.
+     * Other properties and unregistered classes fall back to QMetaProperty.
+     * !!! Writes to bound members do NOT emit NOTIFY signals. Bind a setter if you need them.
+     *
+     * Getters may return by value or by const reference, and setters may return bool to reject values.
+     *
+     * e.g. registerBindings(ClassBindings<MyClass>().member("x", &MyClass::x).property("name", &MyClass::name, &MyClass::setName));
+     * -------------------------------------------------------------------------------- */
+    
+    // Value read through a binding. Common types are stored unboxed.
+    struct BoundValue
+    {
+        enum Type { Bool, Int, LongLong, Double, String, Variant };
+        
+        Type type;
+        bool boolValue;
+        int intValue;
+        qint64 longLongValue;
+        double doubleValue;
+        QString stringValue;
+        QVariant variantValue;
+        
+        BoundValue() : type(Variant), boolValue(false), intValue(0), longLongValue(0), doubleValue(0) {}
+        
+        void set(bool value) { type = Bool; boolValue = value; }
+        void set(int value) { type = Int; intValue = value; }
+        void set(qint64 value) { type = LongLong; longLongValue = value; }
+        void set(double value) { type = Double; doubleValue = value; }
+        void set(const QString &value) { type = String; stringValue = value; }
+        template <class V>
+        void set(const V &value) { type = Variant; variantValue = QVariant::fromValue(value); }
+        
+        QVariant toVariant() const
+        {
+            switch(type) {
+                case Bool: return QVariant(boolValue);
+                case Int: return QVariant(intValue);
+                case LongLong: return QVariant(longLongValue);
+                case Double: return QVariant(doubleValue);
+                case String: return QVariant(stringValue);
+                default: return variantValue;
+            }
+        }
+        
+        // Type that set() stores for values of type V.
+        static Type typeOf(const bool*) { return Bool; }
+        static Type typeOf(const int*) { return Int; }
+        static Type typeOf(const qint64*) { return LongLong; }
+        static Type typeOf(const double*) { return Double; }
+        static Type typeOf(const QString*) { return String; }
+        static Type typeOf(const void*) { return Variant; }
+        
+        // Assign value to target, converting it if needed as QMetaProperty::write() would.
+        template <class V>
+        static bool assign(V &target, const QVariant &value)
+        {
+            const int typeId = qMetaTypeId<V>();
+            if(value.userType() == typeId) {
+                target = *static_cast<const V*>(value.constData());
+                return true;
+            }
+            QVariant converted = value;
+            if(!converted.convert(typeId))
+                return false;
+            target = *static_cast<const V*>(converted.constData());
+            return true;
+        }
+    };
+    
+    // Type erased binding for one property.
+    struct PropertyBinding
+    {
+        // Property name.
+        QString key;
+        // Type of the values that read stores.
+        BoundValue::Type type;
+        std::function<void(const QObject*, BoundValue&)> read;
+        // Empty for read-only bindings, in which case writes use QMetaProperty.
+        std::function<bool(QObject*, const QVariant&)> write;
+        
+        PropertyBinding() : type(BoundValue::Variant) {}
+    };
+    
+    // Builder for the bindings of class T.
+    template <class T>
+    class ClassBindings
+    {
+    public:
+        // Member variable.
+        template <class V>
+        ClassBindings& member(const char *key, V T::*pointer)
+        {
+            PropertyBinding binding = makeBinding<V>(key);
+            binding.read = [pointer](const QObject *object, BoundValue &value) { value.set(static_cast<const T*>(object)->*pointer); };
+            binding.write = [pointer](QObject *object, const QVariant &value) { return BoundValue::assign(static_cast<T*>(object)->*pointer, value); };
+            _bindings.append(binding);
+            return *this;
+        }
+        
+        // Getter, e.g. QString name() const or const QString& name() const.
+        template <class G>
+        ClassBindings& property(const char *key, G (T::*getter)() const)
+        {
+            PropertyBinding binding = makeBinding<G>(key);
+            binding.read = [getter](const QObject *object, BoundValue &value) { value.set((static_cast<const T*>(object)->*getter)()); };
+            _bindings.append(binding);
+            return *this;
+        }
+        
+        // Getter and setter, e.g. void setName(const QString&) or void setName(QString).
+        // Setters that return bool reject a value by returning false. Other return values are ignored.
+        template <class G, class S, class R>
+        ClassBindings& property(const char *key, G (T::*getter)() const, R (T::*setter)(S))
+        {
+            typedef typename std::decay<G>::type Value;
+            PropertyBinding binding = makeBinding<G>(key);
+            binding.read = [getter](const QObject *object, BoundValue &value) { value.set((static_cast<const T*>(object)->*getter)()); };
+            binding.write = [setter](QObject *object, const QVariant &value) {
+                Value converted;
+                if(!BoundValue::assign(converted, value))
+                    return false;
+                return callSetter(static_cast<T*>(object), setter, converted);
+            };
+            _bindings.append(binding);
+            return *this;
+        }
+        
+        const QVector<PropertyBinding>& bindings() const { return _bindings; }
+        
+    private:
+        template <class V>
+        static PropertyBinding makeBinding(const char *key)
+        {
+            typedef typename std::decay<V>::type Value;
+            PropertyBinding binding;
+            binding.key = QString::fromUtf8(key);
+            binding.type = BoundValue::typeOf(static_cast<const Value*>(NULL));
+            return binding;
+        }
+        
+        template <class S, class V>
+        static bool callSetter(T *object, void (T::*setter)(S), const V &value) { (object->*setter)(value); return true; }
+        template <class S, class V>
+        static bool callSetter(T *object, bool (T::*setter)(S), const V &value) { return (object->*setter)(value); }
+        template <class S, class R, class V>
+        static bool callSetter(T *object, R (T::*setter)(S), const V &value) { (object->*setter)(value); return true; }
+        
+        QVector<PropertyBinding> _bindings;
+    };
+    
+    // Bindings apply to objects of the class and its subclasses, and replace any earlier bindings for the class.
+    void registerBindings(const QMetaObject *metaObject, const QVector<PropertyBinding> &bindings);
+    template <class T>
+    void registerBindings(const ClassBindings<T> &bindings) { registerBindings(&T::staticMetaObject, bindings.bindings()); }
+    
+    /* --------------------------------------------------------------------------------
+     * Optional statistics for finding where time goes in a call.
+     * Pass a pointer to serialize(), deserialize(), readJson(), writeJson(), etc.
+     * Counts and times accumulate over calls until clear().
+     * Without statistics (NULL) the only cost is a null check.
+     * -------------------------------------------------------------------------------- */
+    struct Statistics
+    {
+        struct Counts
+        {
+            int objectsVisited;
+            int objectsCreated; // By ObjectFactory::create.
+            int objectsMatched; // To existing children.
+            int propertiesRead;
+            int propertiesWritten;
+            int propertiesSkipped; // Unchanged (see SkipUnchangedProperties) or failed writes.
+            
+            Counts() : objectsVisited(0), objectsCreated(0), objectsMatched(0), propertiesRead(0), propertiesWritten(0), propertiesSkipped(0) {}
+        };
+        
+        // Wall time per phase in nanoseconds.
+        qint64 totalNsecs;
+        qint64 parseNsecs; // Reading and decoding input.
+        qint64 encodeNsecs; // Encoding and writing output.
+        qint64 createNsecs; // Creating objects.
+        qint64 matchNsecs; // Matching child entries to existing children.
+        qint64 readNsecs; // Reading property values.
+        qint64 writeNsecs; // Setting property values.
+        
+        // Totals and breakdown by className.
+        Counts counts;
+        QHash<QByteArray, Counts> classCounts;
+        
+        Statistics() : totalNsecs(0), parseNsecs(0), encodeNsecs(0), createNsecs(0), matchNsecs(0), readNsecs(0), writeNsecs(0) {}
+        void clear() { *this = Statistics(); }
+    };
+    
+    /* --------------------------------------------------------------------------------
+     * Precompiled selection of paths in an object tree for partial serialization.
+     * Each path is a '/' separated list of child steps followed by a property name glob.
+     * Child steps are:
+     *   Class          Children with className Class.
+     *   Class[name]    Children with className Class and objectName name (name may be a glob).
+     *   * or *[name]   Children of any class.
+     *   **             Any number of levels of children (including none).
+     * e.g. "Person[Josephine]/Pet/species" or "Person/*".
+     * A path that starts with ** followed by /height selects height at any depth.
+     * -------------------------------------------------------------------------------- */
+    class Selector
+    {
+    public:
+        Selector() {}
+        explicit Selector(const QString &path) { add(path); }
+        explicit Selector(const QStringList &paths) { for(const QString &path : paths) add(path); }
+        
+        // Throws std::runtime_error for an invalid path.
+        Selector& add(const QString &path);
+        bool isEmpty() const { return _firstSteps.isEmpty(); }
+        
+        // Matching state of an object: indexes of the path steps that apply to the object.
+        typedef QVector<int> State;
+        State rootState() const;
+        // State of a child of an object in state (empty if neither the child nor any of its descendants are selected).
+        State childState(const State &state, const QByteArray &className, const QString &objectName) const;
+        bool matchesProperty(const State &state, const QString &propertyName) const;
+        
+    private:
+        // Glob that is only run as a QRegExp if it has wildcards.
+        struct Pattern
+        {
+            QString text;
+            bool isAny;
+            bool isExact;
+            QRegExp regExp;
+            
+            Pattern() : text("*"), isAny(true), isExact(false) {}
+            explicit Pattern(const QString &text);
+            bool matches(const QString &value) const { return isAny || (isExact ? value == text : regExp.exactMatch(value)); }
+        };
+        
+        struct Step
+        {
+            enum Kind { Child, Descendants, Property };
+            Kind kind;
+            QByteArray className; // Empty for any class.
+            Pattern name; // objectName for Child steps, property name for Property steps.
+            
+            Step() : kind(Child) {}
+        };
+        
+        // Add step to state, along with the steps that follow any ** steps.
+        void addStep(State &state, int step) const;
+        
+        // All paths, each ending with a Property step.
+        QVector<Step> _steps;
+        QVector<int> _firstSteps;
     };
     
     /* --------------------------------------------------------------------------------
      * Serialize QObject --> QVariantMap
      * -------------------------------------------------------------------------------- */
-    QVariantMap serialize(const QObject *object, int childDepth = -1, bool includeReadOnlyProperties = true);
-    QVariantList serialize(const QList<QObject*> objects, int childDepth = -1, bool includeReadOnlyProperties = true);
+    QVariantMap serialize(const QObject *object, int childDepth = -1, bool includeReadOnlyProperties = true, Statistics *statistics = NULL);
+    QVariantList serialize(const QList<QObject*> objects, int childDepth = -1, bool includeReadOnlyProperties = true, Statistics *statistics = NULL);
+    
+    // Only the selected properties and the children on the way to them are read.
+    // objectName is always included so that the data can be matched when it is deserialized,
+    // and children that end up with nothing else are left out.
+    QVariantMap serialize(const QObject *object, const Selector &selector, bool includeReadOnlyProperties = true, Statistics *statistics = NULL);
     
     // Helper function for serialize().
     void addMappedData(QVariantMap &data, const QByteArray &key, const QVariant &value);
@@ -75,18 +497,384 @@ namespace QtPropertySerializer
     /* --------------------------------------------------------------------------------
      * Deserialize QVariantMap --> QObject
      * -------------------------------------------------------------------------------- */
-    void deserialize(QObject *object, const QVariantMap &data, ObjectFactory *factory = NULL);
-    void deserialize(QList<QObject*> &objects, const QVariantList &data, ObjectFactory *factory = NULL, const QByteArray &objectCreatorKey = "");
+    enum DeserializeFlag
+    {
+        NoDeserializeFlags = 0x0,
+        // Do not set properties whose current value already equals the new value.
+        SkipUnchangedProperties = 0x1,
+        // Hold back NOTIFY signals: an object's signals are blocked only while a static property
+        // with a NOTIFY signal is written (so other signals that setter emits are dropped).
+        // All other signals are emitted as usual.
+        // Use the changes list with notifyChanges() to emit NOTIFY signals afterwards.
+        DeferNotifications = 0x2
+    };
+    Q_DECLARE_FLAGS(DeserializeFlags, DeserializeFlag)
+    
+    // A property that was set during deserialization.
+    struct PropertyChange
+    {
+        QPointer<QObject> object;
+        QByteArray propertyName;
+        
+        PropertyChange() {}
+        PropertyChange(QObject *object, const QByteArray &propertyName) : object(object), propertyName(propertyName) {}
+    };
+    
+    // Child entries are matched against object's direct children only (earlier versions also
+    // matched named entries against grandchildren). Unmatched entries create new children.
+    // If changes is not NULL, every property that was actually set is appended to it.
+    void deserialize(QObject *object, const QVariantMap &data, ObjectFactory *factory = NULL, DeserializeFlags flags = NoDeserializeFlags, QList<PropertyChange> *changes = NULL, Statistics *statistics = NULL);
+    void deserialize(QList<QObject*> &objects, const QVariantList &data, ObjectFactory *factory = NULL, const QByteArray &objectCreatorKey = "", Statistics *statistics = NULL);
+    
+    // Only set the selected properties. Child entries that are not on a selected path
+    // are skipped without matching or creating their objects.
+    void deserialize(QObject *object, const QVariantMap &data, const Selector &selector, ObjectFactory *factory = NULL, DeserializeFlags flags = NoDeserializeFlags, QList<PropertyChange> *changes = NULL, Statistics *statistics = NULL);
+    
+    // Emit the NOTIFY signal once for each changed static property (e.g. after DeferNotifications).
+    // Signals with one argument are passed the property's current value.
+    void notifyChanges(const QList<PropertyChange> &changes);
     
     /* --------------------------------------------------------------------------------
      * Read/Write from/to JSON file.
+     * QVector and QList of int, qint64, float or double, and QByteArray values are written
+     * as {"$type": typeName, "$binary": base64 of the little-endian elements}, and are read
+     * back as the same type. readJson(filePath) leaves them as maps, which deserialize() reads.
      * -------------------------------------------------------------------------------- */
     QVariantMap readJson(const QString &filePath);
-    void writeJson(const QVariantMap &data, const QString &filePath);
+    void writeJson(const QVariantMap &data, const QString &filePath, QJsonDocument::JsonFormat format = QJsonDocument::Indented);
+    
+    void readJson(QObject *object, const QString &filePath, ObjectFactory *factory = NULL, DeserializeFlags flags = NoDeserializeFlags, QList<PropertyChange> *changes = NULL, Statistics *statistics = NULL);
+    void writeJson(QObject *object, const QString &filePath, int childDepth = -1, bool includeReadOnlyProperties = true, QJsonDocument::JsonFormat format = QJsonDocument::Indented, Statistics *statistics = NULL);
+    
+    /* --------------------------------------------------------------------------------
+     * Stream JSON to a QIODevice.
+     * The object tree is walked once and written through a bounded buffer
+     * without building an intermediate QVariantMap or QJsonDocument.
+     * Output is readable by readJson(). Throws std::runtime_error if writing fails.
+     * -------------------------------------------------------------------------------- */
+    void writeJson(const QVariantMap &data, QIODevice *device, QJsonDocument::JsonFormat format = QJsonDocument::Indented);
+    void writeJson(const QObject *object, QIODevice *device, int childDepth = -1, bool includeReadOnlyProperties = true, QJsonDocument::JsonFormat format = QJsonDocument::Indented, Statistics *statistics = NULL);
     
-    void readJson(QObject *object, const QString &filePath, ObjectFactory *factory = NULL);
-    void writeJson(QObject *object, const QString &filePath, int childDepth = -1, bool includeReadOnlyProperties = true);
+    /* --------------------------------------------------------------------------------
+     * Stream JSON from a QIODevice into a QObject.
+     * The device is parsed in bounded chunks, and properties are set and children are
+     * matched or created (same rules as deserialize()) as the data arrives.
+     * Memory depends on tree depth rather than data size for children whose objectName
+     * is their first key (as written by writeJson(object, device)). A child with any other
+     * key first (e.g. sorted keys as written by QJsonDocument) is matched only once its
+     * objectName is known, so its raw JSON bytes are held while it is read.
+     * Throws std::runtime_error for malformed JSON.
+     * -------------------------------------------------------------------------------- */
+    void readJson(QObject *object, QIODevice *device, ObjectFactory *factory = NULL, DeserializeFlags flags = NoDeserializeFlags, QList<PropertyChange> *changes = NULL, Statistics *statistics = NULL);
+    
+    /* --------------------------------------------------------------------------------
+     * Write JSON with the object's child subtrees encoded in parallel.
+     * Same output as writeJson(). Properties are read on the calling thread, which takes
+     * a snapshot (i.e. serialize()) of each child subtree. The snapshots are then encoded
+     * by the calling thread and as many threads of pool (default QThreadPool::globalInstance())
+     * as are free, and the encoded subtrees are written in order.
+     * -------------------------------------------------------------------------------- */
+    void writeJsonParallel(const QObject *object, QIODevice *device, int childDepth = -1, bool includeReadOnlyProperties = true, QJsonDocument::JsonFormat format = QJsonDocument::Indented, QThreadPool *pool = NULL);
+    void writeJsonParallel(const QObject *object, const QString &filePath, int childDepth = -1, bool includeReadOnlyProperties = true, QJsonDocument::JsonFormat format = QJsonDocument::Indented, QThreadPool *pool = NULL);
+    
+    /* --------------------------------------------------------------------------------
+     * Newline-delimited JSON (NDJSON) streams of objects.
+     * One compact JSON object per line (same encoding as writeJson()), written as it goes
+     * and read back one record at a time, so memory is bounded by the records in flight
+     * rather than the whole collection. Blank lines are skipped.
+     * Throws std::runtime_error if writing fails or for malformed records.
+     * -------------------------------------------------------------------------------- */
+    // Append one record to device.
+    void writeNdjson(const QObject *object, QIODevice *device, int childDepth = -1, bool includeReadOnlyProperties = true);
+    void writeNdjson(const QVariantMap &data, QIODevice *device);
+    // Append one record per object.
+    void writeNdjson(const QList<QObject*> &objects, QIODevice *device, int childDepth = -1, bool includeReadOnlyProperties = true);
+    
+    // Called on the calling thread for each record in order. Return false to stop reading.
+    // e.g. Create an object with ObjectFactory and deserialize() the record into it.
+    typedef std::function<bool(const QVariantMap &data)> NdjsonCallback;
+    
+    // Returns the number of records passed to callback.
+    qint64 readNdjson(QIODevice *device, const NdjsonCallback &callback);
+    
+    // Same as readNdjson(), but the input is split into batches of lines that are parsed
+    // by pool's threads (default QThreadPool::globalInstance()), a bounded number at a time.
+    // The calling thread parses any batch that no pool thread has started by the time it is
+    // needed, so this does not deadlock when called from one of pool's threads (e.g. inside
+    // another task) or when the pool is busy.
+    qint64 readNdjsonParallel(QIODevice *device, const NdjsonCallback &callback, QThreadPool *pool = NULL);
+    
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    /* --------------------------------------------------------------------------------
+     * Read/Write from/to CBOR file or QIODevice.
+     * Class and property names are written once per file and referenced by index thereafter,
+     * and values are encoded natively (e.g. integers and QByteArray are not converted to text).
+     * Numeric arrays (see JSON above) are written as RFC 8746 little-endian typed arrays,
+     * which are read as QVector and converted to QList for QList properties.
+     * Reading gives the same QVariantMap structure as serialize().
+     * -------------------------------------------------------------------------------- */
+    QVariantMap readCbor(const QString &filePath);
+    void writeCbor(const QVariantMap &data, const QString &filePath);
+    
+    void readCbor(QObject *object, const QString &filePath, ObjectFactory *factory = NULL, DeserializeFlags flags = NoDeserializeFlags, QList<PropertyChange> *changes = NULL, Statistics *statistics = NULL);
+    void writeCbor(QObject *object, const QString &filePath, int childDepth = -1, bool includeReadOnlyProperties = true, Statistics *statistics = NULL);
+    
+    QVariantMap readCbor(QIODevice *device);
+    void writeCbor(const QVariantMap &data, QIODevice *device);
+    
+    void readCbor(QObject *object, QIODevice *device, ObjectFactory *factory = NULL, DeserializeFlags flags = NoDeserializeFlags, QList<PropertyChange> *changes = NULL, Statistics *statistics = NULL);
+    void writeCbor(const QObject *object, QIODevice *device, int childDepth = -1, bool includeReadOnlyProperties = true, Statistics *statistics = NULL);
+#endif
+    
+    /* --------------------------------------------------------------------------------
+     * Lazy loading of large JSON files.
+     * The file is memory mapped and only the top eagerDepth levels of children are read.
+     * The child entries of objects at the deepest level are left in the file as byte spans,
+     * and are deserialized (same rules as readJson()) only when materialize() is called
+     * for their parent. Keys may be in any order (e.g. sorted as written by QJsonDocument):
+     * a child whose objectName is not its first key is skipped and matched from its span. Pending children are not part of the object tree, so materialize
+     * objects before serializing them. Skipped subtrees are only checked for balanced brackets
+     * until they are materialized. Throws std::runtime_error for malformed JSON.
+     * -------------------------------------------------------------------------------- */
+    class LazyDocument
+    {
+    public:
+        LazyDocument();
+        ~LazyDocument(); // Unmaps the file. Pending children can no longer be materialized.
+        
+        // Read the file into object, creating children down to eagerDepth levels below object,
+        // i.e. 0 creates no children and 1 creates only object's direct children.
+        // Closes any previously opened file.
+        void open(QObject *object, const QString &filePath, int eagerDepth = 1, ObjectFactory *factory = NULL, DeserializeFlags flags = NoDeserializeFlags);
+        void close();
+        
+        // True if object has child entries that have not been deserialized yet.
+        bool isPending(const QObject *object) const;
+        QList<QObject*> pendingObjects() const;
+        // Bytes of the file in pending child entries.
+        qint64 pendingSize() const;
+        
+        // Deserialize object's pending children down to childDepth levels below object (-1 for all),
+        // i.e. 1 creates only object's direct children and leaves their children pending.
+        // Deeper children stay pending. Does nothing if childDepth is 0 or object is not pending.
+        void materialize(QObject *object, int childDepth = -1);
+        
+    private:
+        Q_DISABLE_COPY(LazyDocument)
+        struct Private;
+        Private *d;
+    };
+    
+    /* --------------------------------------------------------------------------------
+     * Content hashing.
+     * Merkle-style SHA-1 hash of serialized data: each map and list is hashed from its keys,
+     * its values and the hashes of its nested maps and lists. Equal data gives equal hashes,
+     * which are stable between runs and platforms. Values are hashed by their type name and
+     * QDataStream encoding (or string conversion for types without stream operators),
+     * so e.g. int 1 and double 1.0 hash differently.
+     * -------------------------------------------------------------------------------- */
+    QByteArray contentHash(const QVariantMap &data);
+    
+    // Same as contentHash(serialize(object, childDepth, includeReadOnlyProperties)).
+    QByteArray contentHash(const QObject *object, int childDepth = -1, bool includeReadOnlyProperties = true);
+    
+    /* --------------------------------------------------------------------------------
+     * Asynchronous file writer.
+     * Takes a snapshot (i.e. serialize()) of the object tree on the calling thread, which
+     * should be the thread that owns the objects. Encoding and writing happen on a worker
+     * thread, and the file is replaced atomically (written to a temporary file, synced
+     * to disk, then renamed) via QSaveFile.
+     * Saves to the same file that queue up are coalesced so that only the newest is written.
+     * With setSkipUnchangedWrites(true), a save whose data has the same contentHash() and
+     * format as the last save this writer made to the same file is not written again.
+     * -------------------------------------------------------------------------------- */
+    class AsyncWriter : public QObject
+    {
+        Q_OBJECT
+        
+    public:
+        explicit AsyncWriter(QObject *parent = NULL);
+        ~AsyncWriter(); // Waits for pending writes.
+        
+        // The future's result is true if the file was written.
+        // A save that is superseded by a newer save to the same file gets the result of the newer save.
+        QFuture<bool> writeJson(QObject *object, const QString &filePath, int childDepth = -1, bool includeReadOnlyProperties = true, QJsonDocument::JsonFormat format = QJsonDocument::Indented);
+        QFuture<bool> writeJson(const QVariantMap &data, const QString &filePath, QJsonDocument::JsonFormat format = QJsonDocument::Indented);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+        QFuture<bool> writeCbor(QObject *object, const QString &filePath, int childDepth = -1, bool includeReadOnlyProperties = true);
+        QFuture<bool> writeCbor(const QVariantMap &data, const QString &filePath);
+#endif
+        
+        // Block until all pending writes are finished.
+        void waitForFinished();
+        
+        // Skip writes of unchanged data (default false). Skipped writes succeed and emit finished().
+        // Changes made to the file by others are not detected.
+        void setSkipUnchangedWrites(bool skip);
+        
+    signals:
+        // Emitted from the worker thread after each file write.
+        void finished(const QString &filePath, bool ok, const QString &errorString);
+        
+    private:
+        struct Private;
+        friend class AsyncWriterTask;
+        Private *d;
+        
+        QFuture<bool> enqueue(const QVariantMap &data, const QString &filePath, int format);
+    };
+    
+    /* --------------------------------------------------------------------------------
+     * Change tracker for incremental re-serialization.
+     * Watches a QObject tree for property changes (NOTIFY signals and dynamic property
+     * changes) and for added or removed children, and caches each object's serialized data.
+     * serialize() then only re-serializes changed objects and the child lists of their ancestors.
+     * Properties without a NOTIFY signal must be reported with markDirty().
+     * Must live in the same thread as the tracked objects.
+     * -------------------------------------------------------------------------------- */
+    class ChangeTracker : public QObject
+    {
+        Q_OBJECT
+        
+    public:
+        explicit ChangeTracker(QObject *parent = NULL);
+        ~ChangeTracker();
+        
+        // Start tracking the tree rooted at root (stops tracking any previous tree).
+        void track(QObject *root, bool includeReadOnlyProperties = true);
+        void untrack();
+        QObject* root() const;
+        
+        // Same as QtPropertySerializer::serialize(root, -1, includeReadOnlyProperties).
+        QVariantMap serialize();
+        
+        // True if anything changed since the last call to serialize().
+        bool isDirty() const;
+        
+        // Same as contentHash(serialize()), but only objects that changed since the last call are rehashed.
+        // Unchanged subtrees keep their cached hashes, so comparing two trees is cheap once hashed.
+        QByteArray hash();
+        
+        // Mark object's properties as changed.
+        void markDirty(QObject *object);
+        
+    protected:
+        bool eventFilter(QObject *watched, QEvent *event) override;
+        
+    private slots:
+        void onPropertyChanged();
+        void onDestroyed(QObject *object);
+        
+    private:
+        struct Private;
+        Private *d;
+        
+        void attach(QObject *object, QObject *parent);
+        void detach(QObject *object, bool isAlive);
+        void refresh(QObject *object);
+        QVariantMap rebuild(QObject *object);
+        QByteArray rehash(QObject *object);
+    };
+    
+    /* --------------------------------------------------------------------------------
+     * Structural diff and patch between serialized trees.
+     * Children are matched by className and objectName with the same rules as deserialize(),
+     * so a patch only holds the changed properties, the added or removed children, and the
+     * moves that give each class of children the same order as in newData.
+     * -------------------------------------------------------------------------------- */
+    struct PatchOperation
+    {
+        enum Type { SetProperty, RemoveProperty, AddChild, RemoveChild, MoveChild };
+        
+        // Child of an object given by its className and its index among its parent's children of that class.
+        typedef QPair<QByteArray, int> PathElement;
+        
+        Type type;
+        // Path from the root object to the object that is changed.
+        QList<PathElement> path;
+        // Property name, or className of the added, removed or moved child.
+        QByteArray name;
+        // New property value, or serialized data of the added child.
+        QVariant value;
+        // Index of the removed child, or the new index of the added or moved child,
+        // among the object's children of that class (-1 appends an added child).
+        int index;
+        // Index that a moved child is moved from.
+        int fromIndex;
+        
+        PatchOperation() : type(SetProperty), index(-1), fromIndex(-1) {}
+    };
+    typedef QList<PatchOperation> Patch;
+    
+    // Operations that turn oldData into newData, in the order they must be applied.
+    Patch diff(const QVariantMap &oldData, const QVariantMap &newData);
+    
+    // Apply a patch from diff() to the object tree that oldData was serialized from.
+    // Only objects on the patch's paths are visited. Added children are created as in deserialize(),
+    // and operations on objects that do not exist (or could not be created) are skipped.
+    // RemoveProperty only removes dynamic properties. Static properties keep their values.
+    void applyPatch(QObject *object, const Patch &patch, ObjectFactory *factory = NULL);
+    
+    // Patch <==> QVariantList (e.g. for writeJson() or writeCbor()).
+    QVariantList patchToVariant(const Patch &patch);
+    Patch patchFromVariant(const QVariantList &data);
+    
+    /* --------------------------------------------------------------------------------
+     * Journaled JSON file for autosave.
+     * A snapshot written by writeJson() plus an append-only journal next to it (filePath + ".journal")
+     * with one compact JSON line per save holding the patchToVariant() of the diff since the
+     * previous save, so a save writes bytes in proportion to the edit rather than the document.
+     * Once the journal grows past compactThreshold() bytes, the snapshot is rewritten on a worker
+     * thread and the journal is cut down to the saves made meanwhile. Both files are replaced
+     * atomically, and open() recovers from a compaction that was interrupted by a crash.
+     * Must be used from the thread that owns the object. Throws std::runtime_error if a file
+     * cannot be read or written.
+     * -------------------------------------------------------------------------------- */
+    class Journal : public QObject
+    {
+        Q_OBJECT
+        
+    public:
+        explicit Journal(QObject *parent = NULL);
+        ~Journal(); // Waits for a running compaction.
+        
+        // Read filePath and replay its journal into object (same rules as readJson()), then journal
+        // object's changes. If filePath does not exist, object is written as the first snapshot.
+        void open(QObject *object, const QString &filePath, ObjectFactory *factory = NULL, bool includeReadOnlyProperties = true, QJsonDocument::JsonFormat format = QJsonDocument::Indented);
+        void close(); // Waits for a running compaction.
+        QString filePath() const;
+        
+        // Append the object's changes since the last save (or open()) to the journal.
+        // Returns false if nothing changed.
+        bool save();
+        // Same for the object's serialized data (e.g. from ChangeTracker::serialize()).
+        bool save(const QVariantMap &data);
+        
+        // Size of the journal in bytes.
+        qint64 journalSize() const;
+        
+        // Journal size in bytes above which save() starts a compaction (default 1 MiB).
+        qint64 compactThreshold() const;
+        void setCompactThreshold(qint64 bytes);
+        
+        // Start a compaction unless one is running.
+        void compact();
+        // Block until a running compaction is finished.
+        void waitForCompaction();
+        
+    signals:
+        // Emitted from the worker thread after each compaction.
+        void compacted(bool ok, const QString &errorString);
+        
+    private:
+        Q_DISABLE_COPY(Journal)
+        struct Private;
+        friend class JournalCompactionTask;
+        Private *d;
+    };
     
 } // QtPropertySerializer
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(QtPropertySerializer::DeserializeFlags)
+
 #endif
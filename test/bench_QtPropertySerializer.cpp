@@ -0,0 +1,488 @@
+/* --------------------------------------------------------------------------------
+ * Benchmarks for QtPropertySerializer.
+ *
+ * Usage: bench_QtPropertySerializer [width depth properties dynamicRatio listShare]
+ * Without arguments a default set of synthetic trees is benchmarked.
+ *
+ * Author: Marcel Paz Goldschen-Ohm
+ * Email: marcel.goldschen@gmail.com
+ * -------------------------------------------------------------------------------- */
+
+#include "test_QtPropertySerializer.h"
+#include "bench_QtPropertySerializer.h"
+
+#include <assert.h>
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <QBuffer>
+#include <QElapsedTimer>
+
+#include "QtPropertySerializer.h"
+
+/* --------------------------------------------------------------------------------
+ * Allocation counting.
+ * Counts calls to the global operator new (e.g. QObjects, QVariant private data,
+ * QMap nodes in some Qt versions). Qt containers that allocate with malloc are NOT counted.
+ * Every replaceable form except the over-aligned (C++17) ones is replaced, so that counts
+ * do not depend on which forms the compiler picks (e.g. sized delete with -fsized-deallocation).
+ * -------------------------------------------------------------------------------- */
+namespace
+{
+    std::atomic<long long> numAllocations(0);
+    std::atomic<long long> numLiveAllocations(0);
+    std::atomic<long long> peakLiveAllocations(0);
+    
+    // Returns NULL if out of memory.
+    void* countedAlloc(std::size_t size)
+    {
+        void *ptr = std::malloc(size ? size : 1);
+        if(!ptr)
+            return NULL;
+        ++numAllocations;
+        const long long live = ++numLiveAllocations;
+        long long peak = peakLiveAllocations;
+        while(live > peak && !peakLiveAllocations.compare_exchange_weak(peak, live)) {}
+        return ptr;
+    }
+    
+    void countedFree(void *ptr)
+    {
+        if(!ptr)
+            return;
+        --numLiveAllocations;
+        std::free(ptr);
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    if(void *ptr = countedAlloc(size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    if(void *ptr = countedAlloc(size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+
+void operator delete(void *ptr) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, const std::nothrow_t&) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept { countedFree(ptr); }
+
+/* --------------------------------------------------------------------------------
+ * Timing.
+ * -------------------------------------------------------------------------------- */
+struct Measurement
+{
+    qint64 nsecs = 0;
+    long long allocations = 0;
+    // Peak number of additional live allocations during the run.
+    long long peakAllocations = 0;
+};
+
+// Best of numRepeats runs. setup() is not timed.
+template <class Setup, class Run>
+Measurement measure(int numRepeats, Setup setup, Run run)
+{
+    Measurement best;
+    for(int i = 0; i < numRepeats; ++i) {
+        setup();
+        const long long allocationsBefore = numAllocations;
+        const long long liveBefore = numLiveAllocations;
+        peakLiveAllocations = liveBefore;
+        QElapsedTimer timer;
+        timer.start();
+        run();
+        const qint64 nsecs = timer.nsecsElapsed();
+        if(i == 0 || nsecs < best.nsecs) {
+            best.nsecs = nsecs;
+            best.allocations = numAllocations - allocationsBefore;
+            best.peakAllocations = peakLiveAllocations - liveBefore;
+        }
+    }
+    return best;
+}
+
+void report(const char *name, const Measurement &measurement, int numItems, const char *itemName, qint64 numBytes = 0)
+{
+    const double secs = measurement.nsecs / 1e9;
+    std::cout << "    " << std::left << std::setw(22) << name << std::right << std::fixed
+              << std::setw(10) << std::setprecision(2) << measurement.nsecs / 1e6 << " ms"
+              << std::setw(12) << std::setprecision(0) << numItems / secs << " " << itemName << "/s";
+    if(numBytes)
+        std::cout << std::setw(9) << std::setprecision(1) << numBytes / 1e6 / secs << " MB/s";
+    std::cout << std::setw(10) << measurement.allocations << " allocs"
+              << std::setw(10) << measurement.peakAllocations << " peak" << std::endl;
+}
+
+/* --------------------------------------------------------------------------------
+ * Synthetic object trees.
+ * -------------------------------------------------------------------------------- */
+struct TreeConfig
+{
+    // Children per object.
+    int width = 10;
+    // Levels of children below the root.
+    int depth = 3;
+    // Properties per object (excluding objectName and links).
+    int numProperties = 8;
+    // Fraction of the properties that are dynamic.
+    double dynamicRatio = 0.25;
+    // Fraction of objects with a non-empty QList<QObject*> property.
+    double listShare = 0.1;
+};
+
+class TreeBuilder
+{
+public:
+    explicit TreeBuilder(const TreeConfig &config) : _config(config), _numObjects(0)
+    {
+        // Use the node class with the most static properties that fit,
+        // and make up the difference with dynamic properties.
+        const int numDynamic = qRound(config.numProperties * config.dynamicRatio);
+        const int numStatic = config.numProperties - numDynamic;
+        _numStatic = numStatic >= 16 ? 16 : (numStatic >= 8 ? 8 : (numStatic >= 4 ? 4 : 0));
+        for(int i = 0; i < config.numProperties - _numStatic; ++i)
+            _dynamicPropertyNames.append("dynamic" + QByteArray::number(i));
+    }
+
+    Node0* build()
+    {
+        _numObjects = 0;
+        return createNode(_config.depth);
+    }
+
+    // Number of objects in the last tree that was built, including linked objects.
+    int numObjects() const { return _numObjects; }
+    int numStaticProperties() const { return _numStatic; }
+    int numDynamicProperties() const { return _dynamicPropertyNames.size(); }
+
+private:
+    Node0* newNode() const
+    {
+        switch(_numStatic) {
+            case 16: return new Node16;
+            case 8: return new Node8;
+            case 4: return new Node4;
+            default: return new Node0;
+        }
+    }
+
+    Node0* createNode(int depth)
+    {
+        const int i = _numObjects++;
+        Node0 *node = newNode();
+        node->setObjectName("node" + QString::number(i));
+        node->fill(i);
+        for(int j = 0; j < _dynamicPropertyNames.size(); ++j) {
+            switch(j % 3) {
+                case 0: node->setProperty(_dynamicPropertyNames.at(j).constData(), i + j); break;
+                case 1: node->setProperty(_dynamicPropertyNames.at(j).constData(), i * 0.25 + j); break;
+                default: node->setProperty(_dynamicPropertyNames.at(j).constData(), "dynamic" + QString::number(i)); break;
+            }
+        }
+        // Spread objects with links evenly through the tree.
+        if(int(i * _config.listShare) != int((i + 1) * _config.listShare)) {
+            for(int j = 0; j < 2; ++j) {
+                Node4 *link = new Node4;
+                link->setObjectName("link" + QString::number(j));
+                link->fill(i + j);
+                node->links.append(link);
+                ++_numObjects;
+            }
+        }
+        if(depth > 0) {
+            for(int j = 0; j < _config.width; ++j)
+                createNode(depth - 1)->setParent(node);
+        }
+        return node;
+    }
+
+    TreeConfig _config;
+    int _numObjects;
+    int _numStatic;
+    QList<QByteArray> _dynamicPropertyNames;
+};
+
+void registerNodeClasses(QtPropertySerializer::ObjectFactory &factory)
+{
+    factory.registerClass<Node0>();
+    factory.registerClass<Node4>();
+    factory.registerClass<Node8>();
+    factory.registerClass<Node16>();
+}
+
+// serialize, deserialize, writeJson and readJson for a synthetic tree.
+void benchmarkTree(const TreeConfig &config, int numRepeats = 3)
+{
+    TreeBuilder builder(config);
+    std::unique_ptr<Node0> root(builder.build());
+    const int numObjects = builder.numObjects();
+    std::cout << "  width " << config.width << ", depth " << config.depth
+              << ", " << builder.numStaticProperties() << " static + " << builder.numDynamicProperties() << " dynamic properties"
+              << ", " << qRound(100 * config.listShare) << "% with lists: "
+              << numObjects << " objects" << std::endl;
+
+    QtPropertySerializer::ObjectFactory factory;
+    registerNodeClasses(factory);
+    const QByteArray rootClassName = root->metaObject()->className();
+    std::unique_ptr<QObject> target;
+    auto newTarget = [&target, &factory, &rootClassName]() { target.reset(factory.create(rootClassName)); };
+    auto noSetup = []() {};
+
+    QVariantMap data;
+    report("serialize", measure(numRepeats, noSetup, [&]() { data = QtPropertySerializer::serialize(root.get()); }), numObjects, "objects");
+
+    report("deserialize (create)", measure(numRepeats, newTarget, [&]() { QtPropertySerializer::deserialize(target.get(), data, &factory); }), numObjects, "objects");
+    report("deserialize (update)", measure(numRepeats, noSetup, [&]() { QtPropertySerializer::deserialize(target.get(), data, &factory); }), numObjects, "objects");
+
+    QBuffer buffer;
+    auto openForWriting = [&buffer]() { buffer.close(); buffer.setData(QByteArray()); buffer.open(QIODevice::WriteOnly); };
+    Measurement writeMeasurement = measure(numRepeats, openForWriting, [&]() {
+        QtPropertySerializer::writeJson(root.get(), &buffer, -1, true, QJsonDocument::Compact);
+    });
+    buffer.close();
+    const qint64 jsonSize = buffer.size();
+    report("writeJson", writeMeasurement, numObjects, "objects", jsonSize);
+
+    const QByteArray json = buffer.data();
+    Measurement parallelWriteMeasurement = measure(numRepeats, openForWriting, [&]() {
+        QtPropertySerializer::writeJsonParallel(root.get(), &buffer, -1, true, QJsonDocument::Compact);
+    });
+    buffer.close();
+    assert(buffer.data() == json);
+    report("writeJsonParallel", parallelWriteMeasurement, numObjects, "objects", jsonSize);
+
+    auto openForReading = [&buffer, &newTarget]() { buffer.close(); buffer.open(QIODevice::ReadOnly); newTarget(); };
+    Measurement readMeasurement = measure(numRepeats, openForReading, [&]() {
+        QtPropertySerializer::readJson(target.get(), &buffer, &factory);
+    });
+    buffer.close();
+    assert(target->children().size() == (config.depth > 0 ? config.width : 0));
+    report("readJson", readMeasurement, numObjects, "objects", jsonSize);
+}
+
+// addMappedData for repeated and distinct keys.
+void benchmarkAddMappedData(int numValues, int numRepeats = 3)
+{
+    std::cout << "  " << numValues << " values:" << std::endl;
+    QVariantMap data;
+    auto clear = [&data]() { data.clear(); };
+
+    // All values under one key are collected in a list.
+    report("same key", measure(numRepeats, clear, [&]() {
+        for(int i = 0; i < numValues; ++i)
+            QtPropertySerializer::addMappedData(data, "key", i);
+    }), numValues, "values");
+    assert(data["key"].toList().size() == numValues);
+
+    std::vector<QByteArray> keys;
+    keys.reserve(numValues);
+    for(int i = 0; i < numValues; ++i)
+        keys.push_back("key" + QByteArray::number(i));
+    report("distinct keys", measure(numRepeats, clear, [&]() {
+        for(int i = 0; i < numValues; ++i)
+            QtPropertySerializer::addMappedData(data, keys[i], i);
+    }), numValues, "values");
+    assert(data.size() == numValues);
+}
+
+// Serialize a parent with many children of the same class.
+// Time per child should stay roughly constant as the number of children grows.
+void benchmarkWideParent(int numChildren)
+{
+    QObject parent;
+    for(int i = 0; i < numChildren; ++i) {
+        Pet *pet = new Pet("pet" + QString::number(i));
+        pet->species = "dog";
+        pet->setParent(&parent);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QVariantMap data = QtPropertySerializer::serialize(&parent);
+    const qint64 nsecs = timer.nsecsElapsed();
+
+    assert(data["Pet"].toList().size() == numChildren);
+
+    std::cout << "  " << numChildren << " children: "
+              << nsecs / 1000000.0 << " ms ("
+              << double(nsecs) / numChildren << " ns/child)" << std::endl;
+}
+
+// Deserialize many new children of one class with the default and pooled creators.
+template <class T>
+qint64 timeChildCreation(const QVariantMap &data, QtPropertySerializer::ObjectFactory &factory, int numChildren)
+{
+    QObject parent;
+    QElapsedTimer timer;
+    timer.start();
+    QtPropertySerializer::deserialize(&parent, data, &factory);
+    const qint64 nsecs = timer.nsecsElapsed();
+    assert(parent.findChildren<T*>(QString(), Qt::FindDirectChildrenOnly).size() == numChildren);
+    return nsecs;
+}
+
+void benchmarkChildCreation(int numChildren)
+{
+    QVariantList nodeDataList;
+    for(int i = 0; i < numChildren; ++i) {
+        QVariantMap nodeData;
+        nodeData["objectName"] = "node" + QString::number(i);
+        nodeData["i0"] = i;
+        nodeDataList.append(nodeData);
+    }
+    QVariantMap data;
+    data["Node4"] = nodeDataList;
+    QVariantMap pooledData;
+    pooledData["PooledNode4"] = nodeDataList;
+
+    QtPropertySerializer::ObjectFactory factory;
+    factory.registerClass<Node4>();
+    factory.registerPooledClass<PooledNode4>();
+    // Warm up the pool so that both runs start from a steady state.
+    timeChildCreation<PooledNode4>(pooledData, factory, numChildren);
+
+    const qint64 nsecs = timeChildCreation<Node4>(data, factory, numChildren);
+    const qint64 pooledNsecs = timeChildCreation<PooledNode4>(pooledData, factory, numChildren);
+    std::cout << "  " << numChildren << " children: "
+              << double(nsecs) / numChildren << " ns/child, pooled "
+              << double(pooledNsecs) / numChildren << " ns/child" << std::endl;
+}
+
+// Compare JSON and CBOR file size and read/write speed for a large tree.
+void benchmarkJsonVsCbor(int numPersons, int numPetsPerPerson)
+{
+    Person root("root");
+    for(int i = 0; i < numPersons; ++i) {
+        Person *person = new Person("person" + QString::number(i));
+        person->heightInCm = 100 + i % 100;
+        person->dateOfBirth = QDate(1950 + i % 50, 1 + i % 12, 1 + i % 28);
+        person->setParent(&root);
+        for(int j = 0; j < numPetsPerPerson; ++j) {
+            Pet *pet = new Pet("pet" + QString::number(j));
+            pet->species = j % 2 ? "cat" : "dog";
+            pet->setParent(person);
+        }
+    }
+    const int numObjects = 1 + numPersons * (1 + numPetsPerPerson);
+    std::cout << "  " << numObjects << " objects:" << std::endl;
+
+    QtPropertySerializer::ObjectFactory factory;
+    factory.registerClass<Person>();
+    factory.registerClass<Pet>();
+
+    QElapsedTimer timer;
+    QBuffer buffer;
+
+    buffer.open(QIODevice::WriteOnly);
+    timer.start();
+    QtPropertySerializer::writeJson(&root, &buffer, -1, true, QJsonDocument::Compact);
+    const qint64 jsonWriteNsecs = timer.nsecsElapsed();
+    buffer.close();
+    const qint64 jsonSize = buffer.size();
+    buffer.open(QIODevice::ReadOnly);
+    Person jsonRoot;
+    timer.start();
+    QtPropertySerializer::readJson(&jsonRoot, &buffer, &factory);
+    const qint64 jsonReadNsecs = timer.nsecsElapsed();
+    buffer.close();
+    assert(jsonRoot.children().size() == numPersons);
+    std::cout << "    JSON: " << jsonSize / 1024.0 << " KB, write "
+              << jsonWriteNsecs / 1000000.0 << " ms, read "
+              << jsonReadNsecs / 1000000.0 << " ms" << std::endl;
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    buffer.setData(QByteArray());
+    buffer.open(QIODevice::WriteOnly);
+    timer.start();
+    QtPropertySerializer::writeCbor(&root, &buffer);
+    const qint64 cborWriteNsecs = timer.nsecsElapsed();
+    buffer.close();
+    const qint64 cborSize = buffer.size();
+    buffer.open(QIODevice::ReadOnly);
+    Person cborRoot;
+    timer.start();
+    QtPropertySerializer::readCbor(&cborRoot, &buffer, &factory);
+    const qint64 cborReadNsecs = timer.nsecsElapsed();
+    buffer.close();
+    assert(cborRoot.children().size() == numPersons);
+    std::cout << "    CBOR: " << cborSize / 1024.0 << " KB, write "
+              << cborWriteNsecs / 1000000.0 << " ms, read "
+              << cborReadNsecs / 1000000.0 << " ms" << std::endl;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    std::cout << "Running benchmarks for QtPropertySerializer..." << std::endl;
+
+    if(argc == 6) {
+        // Single tree from the command line.
+        TreeConfig config;
+        config.width = std::atoi(argv[1]);
+        config.depth = std::atoi(argv[2]);
+        config.numProperties = std::atoi(argv[3]);
+        config.dynamicRatio = std::atof(argv[4]);
+        config.listShare = std::atof(argv[5]);
+        std::cout << "Synthetic tree:" << std::endl;
+        benchmarkTree(config);
+        return 0;
+    } else if(argc != 1) {
+        std::cout << "Usage: " << argv[0] << " [width depth properties dynamicRatio listShare]" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Synthetic trees:" << std::endl;
+    TreeConfig config;
+    config.depth = 4; // 11111 objects
+    benchmarkTree(config);
+    config.numProperties = 16;
+    config.dynamicRatio = 0;
+    benchmarkTree(config);
+    config.dynamicRatio = 0.5;
+    benchmarkTree(config);
+    config.numProperties = 8;
+    config.dynamicRatio = 0.25;
+    config.listShare = 0.5;
+    benchmarkTree(config);
+    config.listShare = 0.1;
+    config.width = 100; // Wide
+    config.depth = 2;
+    benchmarkTree(config);
+    config.width = 2; // Deep
+    config.depth = 13;
+    benchmarkTree(config);
+
+    std::cout << "Adding mapped data:" << std::endl;
+    benchmarkAddMappedData(100000);
+
+    std::cout << "Serializing wide parents:" << std::endl;
+    for(int numChildren : {1000, 5000, 20000, 50000})
+        benchmarkWideParent(numChildren);
+
+    std::cout << "Deserializing new children:" << std::endl;
+    for(int numChildren : {1000, 20000, 100000})
+        benchmarkChildCreation(numChildren);
+
+    std::cout << "Comparing JSON and CBOR:" << std::endl;
+    for(int numPersons : {1000, 10000, 50000})
+        benchmarkJsonVsCbor(numPersons, 3);
+
+    return 0;
+}
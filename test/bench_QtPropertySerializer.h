@@ -0,0 +1,126 @@
+/* --------------------------------------------------------------------------------
+ * Synthetic object classes for QtPropertySerializer benchmarks.
+ *
+ * Author: Marcel Paz Goldschen-Ohm
+ * Email: marcel.goldschen@gmail.com
+ * -------------------------------------------------------------------------------- */
+
+#ifndef __bench_QtPropertySerializer_H__
+#define __bench_QtPropertySerializer_H__
+
+#include <QByteArray>
+#include <QDate>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+#include "QtPropertySerializer.h"
+
+// Tree nodes with 0, 4, 8 or 16 static properties (not counting objectName and links).
+class Node0 : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QList<QObject*> links MEMBER links)
+
+public:
+    // Non-child objects that are serialized as children (like Person::pets).
+    QList<QObject*> links;
+
+    ~Node0() { qDeleteAll(links); }
+
+    // Set property values based on i.
+    virtual void fill(int) {}
+};
+
+class Node4 : public Node0
+{
+    Q_OBJECT
+    Q_PROPERTY(int i0 MEMBER i0)
+    Q_PROPERTY(double d0 MEMBER d0)
+    Q_PROPERTY(QString s0 MEMBER s0)
+    Q_PROPERTY(bool b0 MEMBER b0)
+
+public:
+    int i0 = 0;
+    double d0 = 0;
+    QString s0;
+    bool b0 = false;
+
+    void fill(int i) override
+    {
+        Node0::fill(i);
+        i0 = i;
+        d0 = i * 0.5;
+        s0 = "value" + QString::number(i);
+        b0 = i % 2;
+    }
+};
+
+class Node8 : public Node4
+{
+    Q_OBJECT
+    Q_PROPERTY(QDate date0 MEMBER date0)
+    Q_PROPERTY(QStringList list0 MEMBER list0)
+    Q_PROPERTY(qlonglong l0 MEMBER l0)
+    Q_PROPERTY(QByteArray bytes0 MEMBER bytes0)
+
+public:
+    QDate date0;
+    QStringList list0;
+    qlonglong l0 = 0;
+    QByteArray bytes0;
+
+    void fill(int i) override
+    {
+        Node4::fill(i);
+        date0 = QDate(2000, 1, 1).addDays(i % 10000);
+        list0 = QStringList() << "a" << QString::number(i);
+        l0 = qlonglong(i) << 32;
+        bytes0 = QByteArray::number(i);
+    }
+};
+
+class Node16 : public Node8
+{
+    Q_OBJECT
+    Q_PROPERTY(int i1 MEMBER i1)
+    Q_PROPERTY(int i2 MEMBER i2)
+    Q_PROPERTY(double d1 MEMBER d1)
+    Q_PROPERTY(double d2 MEMBER d2)
+    Q_PROPERTY(QString s1 MEMBER s1)
+    Q_PROPERTY(QString s2 MEMBER s2)
+    Q_PROPERTY(bool b1 MEMBER b1)
+    Q_PROPERTY(QDate date1 MEMBER date1)
+
+public:
+    int i1 = 0;
+    int i2 = 0;
+    double d1 = 0;
+    double d2 = 0;
+    QString s1;
+    QString s2;
+    bool b1 = false;
+    QDate date1;
+
+    void fill(int i) override
+    {
+        Node8::fill(i);
+        i1 = -i;
+        i2 = i * 7;
+        d1 = i / 3.0;
+        d2 = 1e6 + i;
+        s1 = "name" + QString::number(i);
+        s2 = "a somewhat longer string value for node " + QString::number(i);
+        b1 = i % 3;
+        date1 = QDate(1970, 1, 1).addDays(i % 20000);
+    }
+};
+
+// Node4 allocated from a per-class pool.
+class PooledNode4 : public Node4, public QtPropertySerializer::PooledAllocation<PooledNode4>
+{
+    Q_OBJECT
+};
+
+#endif // __bench_QtPropertySerializer_H__
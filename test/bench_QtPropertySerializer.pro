@@ -0,0 +1,18 @@
+TARGET = bench_QtPropertySerializer
+TEMPLATE = app
+QT += core
+QT -= gui
+CONFIG += c++11
+
+OBJECTS_DIR = Release/.obj
+MOC_DIR = Release/.moc
+RCC_DIR = Release/.rcc
+UI_DIR = Release/.ui
+
+INCLUDEPATH += ..
+
+HEADERS += ../QtPropertySerializer.h
+SOURCES += ../QtPropertySerializer.cpp
+
+HEADERS += test_QtPropertySerializer.h bench_QtPropertySerializer.h
+SOURCES += bench_QtPropertySerializer.cpp
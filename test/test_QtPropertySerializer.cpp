@@ -7,8 +7,20 @@
 
 #include "test_QtPropertySerializer.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
+#include <stdexcept>
+
+#include <QBuffer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QRunnable>
+#include <QThreadPool>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+#include <QCborMap>
+#include <QCborValue>
+#endif
 
 #include "QtPropertySerializer.h"
 
@@ -139,6 +151,26 @@ int main(int, char **)
     assert(bizarroSpot->species == spot->species);
     assert(bizarroSpot->property("vaccinated").toBool() == spot->property("vaccinated").toBool());
     
+    // A named child entry only matches direct children, never a grandchild with the same name.
+    {
+        Person owner("Owner");
+        Person *kid = new Person("Kid");
+        kid->setParent(&owner);
+        Pet *rex = new Pet("Rex");
+        rex->setParent(kid);
+        rex->species = "dog";
+        QVariantMap rexData;
+        rexData["objectName"] = "Rex";
+        rexData["species"] = "cat";
+        QVariantMap ownerData;
+        ownerData["Pet"] = rexData;
+        QtPropertySerializer::deserialize(&owner, ownerData, &factory);
+        assert(rex->species == "dog");
+        Pet *ownerRex = owner.findChild<Pet*>("Rex", Qt::FindDirectChildrenOnly);
+        assert(ownerRex && ownerRex != rex);
+        assert(ownerRex->species == "cat");
+    }
+    
     std::cout << "OK" << std::endl;
     
     //------------------------
@@ -153,5 +185,944 @@ int main(int, char **)
     
     std::cout << "OK" << std::endl;
     
+    std::cout << "Checking streaming JSON output to a QIODevice... ";
+    
+    // Streamed JSON should parse to the same document as the serialized QVariantMap.
+    QVariantMap expectedJsonData = QJsonDocument::fromVariant(QtPropertySerializer::serialize(&jane)).toVariant().toMap();
+    for(QJsonDocument::JsonFormat format : {QJsonDocument::Indented, QJsonDocument::Compact}) {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeJson(&jane, &buffer, -1, true, format);
+        assert(QJsonDocument::fromJson(buffer.data()).toVariant().toMap() == expectedJsonData);
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking streaming JSON input from a QIODevice... ";
+    
+    // Streaming into a new object should give the same result as readJson() --> deserialize().
+    {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeJson(&jane, &buffer);
+        buffer.close();
+        buffer.open(QIODevice::ReadOnly);
+        Person streamedJane;
+        QtPropertySerializer::readJson(&streamedJane, &buffer, &factory);
+        Person expectedJane;
+        QtPropertySerializer::deserialize(&expectedJane, QJsonDocument::fromJson(buffer.data()).toVariant().toMap(), &factory);
+        assert(QtPropertySerializer::serialize(&streamedJane) == QtPropertySerializer::serialize(&expectedJane));
+        assert(streamedJane.findChild<Pet*>("Spot")->species == spot->species);
+    }
+    
+    // QJsonDocument sorts keys, so objectName is not the first key of any object.
+    // Children are read again from their spans, including spans that cross the decoder's chunks.
+    {
+        Person family("Family");
+        for(int i = 0; i < 1000; ++i) {
+            Pet *pet = new Pet(QString("Pet%1").arg(i));
+            pet->setParent(&family);
+            pet->species = "cat";
+        }
+        Person *member = new Person("Member");
+        member->setParent(&family);
+        member->heightInCm = 120;
+        Pet *rex = new Pet("Rex");
+        rex->setParent(member);
+        rex->species = "dog";
+        const QByteArray sortedJson = QJsonDocument::fromVariant(QtPropertySerializer::serialize(&family)).toJson();
+        assert(sortedJson.size() > 64 * 1024);
+        assert(sortedJson.indexOf("\"objectName\"") > sortedJson.indexOf("\"Person\""));
+        QBuffer buffer;
+        buffer.setData(sortedJson);
+        buffer.open(QIODevice::ReadOnly);
+        Person streamedFamily;
+        QtPropertySerializer::readJson(&streamedFamily, &buffer, &factory);
+        Person expectedFamily;
+        QtPropertySerializer::deserialize(&expectedFamily, QJsonDocument::fromJson(sortedJson).toVariant().toMap(), &factory);
+        assert(QtPropertySerializer::serialize(&streamedFamily) == QtPropertySerializer::serialize(&expectedFamily));
+        assert(streamedFamily.findChildren<Pet*>(QString(), Qt::FindDirectChildrenOnly).size() == 1000);
+        assert(streamedFamily.findChild<Pet*>("Rex")->species == "dog");
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    std::cout << "Checking serialization/deserialization to/from CBOR... ";
+    
+    {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeCbor(&jane, &buffer);
+        buffer.close();
+        
+        // Reading should give back the same QVariantMap that serialize() produces.
+        buffer.open(QIODevice::ReadOnly);
+        QVariantMap cborData = QtPropertySerializer::readCbor(&buffer);
+        assert(cborData == QtPropertySerializer::serialize(&jane));
+        buffer.close();
+        
+        buffer.open(QIODevice::ReadOnly);
+        Person cborJane;
+        QtPropertySerializer::readCbor(&cborJane, &buffer, &factory);
+        assert(cborJane.heightInCm == jane.heightInCm);
+        assert(cborJane.dateOfBirth == jane.dateOfBirth);
+        assert(cborJane.findChild<Pet*>("Spot")->species == spot->species);
+    }
+    
+    std::cout << "OK" << std::endl;
+#endif
+    
+    std::cout << "Checking asynchronous JSON file write... ";
+    
+    {
+        QtPropertySerializer::AsyncWriter writer;
+        // Queued saves to the same file are coalesced, but all of them report success.
+        QList<QFuture<bool> > futures;
+        for(int i = 0; i < 3; ++i)
+            futures.append(writer.writeJson(&jane, "jane_async.json"));
+        writer.waitForFinished();
+        for(QFuture<bool> &future : futures)
+            assert(future.result());
+        assert(QtPropertySerializer::readJson("jane_async.json") == QJsonDocument::fromVariant(QtPropertySerializer::serialize(&jane)).toVariant().toMap());
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking incremental serialization with change tracking... ";
+    
+    {
+        QtPropertySerializer::ChangeTracker tracker;
+        tracker.track(&jane);
+        assert(tracker.serialize() == QtPropertySerializer::serialize(&jane));
+        assert(!tracker.isDirty());
+        
+        // objectName has a NOTIFY signal.
+        john->setObjectName("Johnny");
+        assert(tracker.isDirty());
+        assert(tracker.serialize() == QtPropertySerializer::serialize(&jane));
+        
+        // Dynamic properties.
+        spot->setProperty("vaccinated", false);
+        assert(tracker.serialize() == QtPropertySerializer::serialize(&jane));
+        
+        // Properties without a NOTIFY signal.
+        josephine->heightInCm = 60;
+        tracker.markDirty(josephine);
+        assert(tracker.serialize() == QtPropertySerializer::serialize(&jane));
+        
+        // Added and removed children.
+        Pet *rex = new Pet("Rex");
+        rex->setParent(john);
+        assert(tracker.serialize() == QtPropertySerializer::serialize(&jane));
+        delete rex;
+        assert(tracker.serialize() == QtPropertySerializer::serialize(&jane));
+        
+        john->setObjectName("John");
+        spot->setProperty("vaccinated", true);
+        josephine->heightInCm = 50;
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking skipped and deferred property changes... ";
+    
+    {
+        Pet pet("Max");
+        pet.species = "dog";
+        pet.setProperty("age", 3);
+        QVariantMap data = QtPropertySerializer::serialize(&pet);
+        int numNameChanges = 0;
+        QObject::connect(&pet, &QObject::objectNameChanged, [&numNameChanges]() { ++numNameChanges; });
+        
+        // Nothing changes.
+        QList<QtPropertySerializer::PropertyChange> changes;
+        QtPropertySerializer::deserialize(&pet, data, NULL, QtPropertySerializer::SkipUnchangedProperties, &changes);
+        assert(changes.isEmpty());
+        
+        // Only changed properties are set, and notified after deserialize() returns.
+        data["objectName"] = "Maximus";
+        data["age"] = 4.0; // e.g. JSON numbers are doubles
+        QtPropertySerializer::deserialize(&pet, data, NULL, QtPropertySerializer::SkipUnchangedProperties | QtPropertySerializer::DeferNotifications, &changes);
+        assert(changes.size() == 2);
+        assert(pet.objectName() == "Maximus");
+        assert(pet.property("age").toInt() == 4);
+        assert(numNameChanges == 0);
+        QtPropertySerializer::notifyChanges(changes);
+        assert(numNameChanges == 1);
+    }
+    
+    // Only NOTIFY signals are deferred. Other signals are emitted as properties are set.
+    {
+        Tag tag;
+        tag.setObjectName("tag");
+        QVariantMap data = QtPropertySerializer::serialize(&tag);
+        data["objectName"] = "heavy";
+        data["weight"] = 10;
+        int numNameChanges = 0;
+        int numWeightSets = 0;
+        QObject::connect(&tag, &QObject::objectNameChanged, [&numNameChanges]() { ++numNameChanges; });
+        QObject::connect(&tag, &Tag::weightSet, [&numWeightSets]() { ++numWeightSets; });
+        QList<QtPropertySerializer::PropertyChange> changes;
+        QtPropertySerializer::deserialize(&tag, data, NULL, QtPropertySerializer::SkipUnchangedProperties | QtPropertySerializer::DeferNotifications, &changes);
+        assert(tag.weight() == 10);
+        assert(numWeightSets == 1);
+        assert(numNameChanges == 0);
+        QtPropertySerializer::notifyChanges(changes);
+        assert(numNameChanges == 1);
+    }
+    
+    // Binary arrays of another container type (e.g. QVector from CBOR for a QList property) compare equal.
+    {
+        Trace trace;
+        trace.counts = QList<int>() << 1 << 2 << 3;
+        QVariantMap data;
+        data["counts"] = QVariant::fromValue(QVector<int>() << 1 << 2 << 3);
+        QList<QtPropertySerializer::PropertyChange> changes;
+        QtPropertySerializer::deserialize(&trace, data, NULL, QtPropertySerializer::SkipUnchangedProperties, &changes);
+        assert(changes.isEmpty());
+        data["counts"] = QVariant::fromValue(QVector<int>() << 1 << 2 << 4);
+        QtPropertySerializer::deserialize(&trace, data, NULL, QtPropertySerializer::SkipUnchangedProperties, &changes);
+        assert(changes.size() == 1);
+        assert(trace.counts == QList<int>() << 1 << 2 << 4);
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking diff and patch... ";
+    
+    {
+        Person grandma("Grandma");
+        Person *mom = new Person("Mom");
+        mom->setParent(&grandma);
+        Pet *fluffy = new Pet("Fluffy");
+        fluffy->setParent(mom);
+        Pet *stray = new Pet;
+        stray->setParent(&grandma);
+        const QVariantMap oldData = QtPropertySerializer::serialize(&grandma);
+        
+        // Copy of the original tree.
+        Person replica;
+        QtPropertySerializer::deserialize(&replica, oldData, &factory);
+        assert(QtPropertySerializer::serialize(&replica) == oldData);
+        
+        grandma.setProperty("retired", true);
+        mom->heightInCm = 165;
+        delete fluffy;
+        Pet *rover = new Pet("Rover");
+        rover->setParent(mom);
+        stray->species = "cat";
+        const QVariantMap newData = QtPropertySerializer::serialize(&grandma);
+        
+        // Only the changes are in the patch.
+        QtPropertySerializer::Patch patch = QtPropertySerializer::diff(oldData, newData);
+        assert(patch.size() == 5);
+        assert(QtPropertySerializer::diff(newData, newData).isEmpty());
+        
+        patch = QtPropertySerializer::patchFromVariant(QtPropertySerializer::patchToVariant(patch));
+        QtPropertySerializer::applyPatch(&replica, patch, &factory);
+        assert(QtPropertySerializer::serialize(&replica) == newData);
+        
+        // Undo.
+        QtPropertySerializer::applyPatch(&replica, QtPropertySerializer::diff(newData, oldData), &factory);
+        assert(QtPropertySerializer::serialize(&replica) == oldData);
+    }
+    
+    {
+        // The order of several children of the same class is restored.
+        Person family("Family");
+        Person *a = new Person("A");
+        a->setParent(&family);
+        Person *b = new Person("B");
+        b->setParent(&family);
+        QList<Pet*> strays;
+        for(int i = 0; i < 3; ++i) {
+            Pet *stray = new Pet;
+            stray->species = "stray" + QString::number(i);
+            stray->setParent(&family);
+            strays.append(stray);
+        }
+        const QVariantMap oldData = QtPropertySerializer::serialize(&family);
+        Person replica;
+        QtPropertySerializer::deserialize(&replica, oldData, &factory);
+        assert(QtPropertySerializer::serialize(&replica) == oldData);
+        
+        // Remove a middle unnamed child, and remove and re-add a named child.
+        delete strays.at(1);
+        delete a;
+        Person *newA = new Person("A");
+        newA->heightInCm = 180;
+        newA->setParent(&family);
+        const QVariantMap newData = QtPropertySerializer::serialize(&family);
+        
+        QtPropertySerializer::Patch patch = QtPropertySerializer::patchFromVariant(QtPropertySerializer::patchToVariant(QtPropertySerializer::diff(oldData, newData)));
+        QtPropertySerializer::applyPatch(&replica, patch, &factory);
+        assert(QtPropertySerializer::serialize(&replica) == newData);
+        QtPropertySerializer::applyPatch(&replica, QtPropertySerializer::diff(newData, oldData), &factory);
+        assert(QtPropertySerializer::serialize(&replica) == oldData);
+    }
+    
+    {
+        // Static properties missing from the new data (e.g. left out by a selection) are kept,
+        // while dynamic properties are removed.
+        Pet pet("Felix");
+        pet.species = "cat";
+        pet.setProperty("age", 3);
+        const QVariantMap oldData = QtPropertySerializer::serialize(&pet);
+        QVariantMap newData = oldData;
+        newData.remove("species");
+        newData.remove("age");
+        const QtPropertySerializer::Patch patch = QtPropertySerializer::diff(oldData, newData);
+        assert(patch.size() == 2);
+        QtPropertySerializer::applyPatch(&pet, patch, &factory);
+        assert(pet.species == "cat");
+        assert(!pet.property("age").isValid());
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking statistics... ";
+    
+    {
+        Person owner("Owner");
+        Pet *cat = new Pet("Cat");
+        cat->setParent(&owner);
+        Pet *dog = new Pet("Dog");
+        dog->setParent(&owner);
+        
+        QtPropertySerializer::Statistics statistics;
+        const QVariantMap ownerData = QtPropertySerializer::serialize(&owner, -1, true, &statistics);
+        assert(statistics.counts.objectsVisited == 3);
+        assert(statistics.classCounts["Pet"].objectsVisited == 2);
+        assert(statistics.classCounts["Pet"].propertiesRead == 4);
+        
+        // New children are created.
+        statistics.clear();
+        Person copy;
+        QtPropertySerializer::deserialize(&copy, ownerData, &factory, QtPropertySerializer::NoDeserializeFlags, NULL, &statistics);
+        assert(statistics.counts.objectsCreated == 2);
+        assert(statistics.counts.objectsMatched == 0);
+        assert(statistics.classCounts["Pet"].propertiesWritten == 4);
+        
+        // Existing children are matched, and nothing needs to be written.
+        statistics.clear();
+        QtPropertySerializer::deserialize(&copy, ownerData, &factory, QtPropertySerializer::SkipUnchangedProperties, NULL, &statistics);
+        assert(statistics.counts.objectsCreated == 0);
+        assert(statistics.counts.objectsMatched == 2);
+        assert(statistics.counts.propertiesWritten == 0);
+        assert(statistics.counts.propertiesSkipped > 0);
+        
+        // Time not spent on objects is attributed to parsing.
+        statistics.clear();
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeJson(&owner, &buffer, -1, true, QJsonDocument::Compact, &statistics);
+        buffer.close();
+        buffer.open(QIODevice::ReadOnly);
+        Person streamedCopy;
+        QtPropertySerializer::readJson(&streamedCopy, &buffer, &factory, QtPropertySerializer::NoDeserializeFlags, NULL, &statistics);
+        assert(statistics.counts.objectsCreated == 2);
+        assert(statistics.totalNsecs >= statistics.parseNsecs + statistics.encodeNsecs);
+        
+        // List and selector overloads collect statistics too.
+        statistics.clear();
+        QList<QObject*> pets;
+        pets << cat << dog;
+        const QVariantList petsData = QtPropertySerializer::serialize(pets, -1, true, &statistics);
+        assert(statistics.classCounts["Pet"].objectsVisited == 2);
+        statistics.clear();
+        QtPropertySerializer::deserialize(pets, petsData, &factory, "", &statistics);
+        assert(statistics.classCounts["Pet"].propertiesWritten == 4);
+        
+        statistics.clear();
+        const QtPropertySerializer::Selector selector("Pet[Cat]/species");
+        const QVariantMap catSpecies = QtPropertySerializer::serialize(&owner, selector, true, &statistics);
+        assert(statistics.classCounts["Pet"].objectsVisited == 1);
+        assert(statistics.classCounts["Pet"].propertiesRead == 2);
+        statistics.clear();
+        QtPropertySerializer::deserialize(&copy, catSpecies, selector, &factory, QtPropertySerializer::NoDeserializeFlags, NULL, &statistics);
+        assert(statistics.counts.objectsMatched == 1);
+        assert(statistics.classCounts["Pet"].propertiesWritten == 1);
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking typed property bindings... ";
+    
+    {
+        const QVariantMap reflectiveData = QtPropertySerializer::serialize(&jane);
+        QBuffer reflectiveJson;
+        reflectiveJson.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeJson(&jane, &reflectiveJson);
+        reflectiveJson.close();
+        
+        QtPropertySerializer::registerBindings(QtPropertySerializer::ClassBindings<Person>()
+                                               .member("height", &Person::heightInCm)
+                                               .member("dob", &Person::dateOfBirth));
+        QtPropertySerializer::registerBindings(QtPropertySerializer::ClassBindings<Pet>()
+                                               .member("species", &Pet::species));
+        
+        // Same data as the reflective path.
+        assert(QtPropertySerializer::serialize(&jane) == reflectiveData);
+        QBuffer boundJson;
+        boundJson.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeJson(&jane, &boundJson);
+        boundJson.close();
+        assert(boundJson.data() == reflectiveJson.data());
+        
+        // Bound members are written directly.
+        Person boundJane;
+        boundJson.open(QIODevice::ReadOnly);
+        QtPropertySerializer::readJson(&boundJane, &boundJson, &factory);
+        assert(boundJane.heightInCm == jane.heightInCm);
+        assert(boundJane.dateOfBirth == jane.dateOfBirth);
+        assert(boundJane.findChild<Pet*>("Spot")->species == spot->species);
+        
+        QtPropertySerializer::registerBindings(&Person::staticMetaObject, QVector<QtPropertySerializer::PropertyBinding>());
+        QtPropertySerializer::registerBindings(&Pet::staticMetaObject, QVector<QtPropertySerializer::PropertyBinding>());
+    }
+    
+    {
+        // Getters that return a const reference, and setters that return bool.
+        Tag tag;
+        tag.setObjectName("tag");
+        tag.setLabel("red");
+        tag.setWeight(3);
+        const QVariantMap reflectiveData = QtPropertySerializer::serialize(&tag);
+        QtPropertySerializer::registerBindings(QtPropertySerializer::ClassBindings<Tag>()
+                                               .property("label", &Tag::label, &Tag::setLabel)
+                                               .property("weight", &Tag::weight, &Tag::setWeight));
+        assert(QtPropertySerializer::serialize(&tag) == reflectiveData);
+        
+        Tag boundTag;
+        QtPropertySerializer::deserialize(&boundTag, reflectiveData);
+        assert(boundTag.label() == "red");
+        assert(boundTag.weight() == 3);
+        
+        // Rejected by the setter.
+        QVariantMap data = reflectiveData;
+        data["label"] = QString();
+        QtPropertySerializer::deserialize(&boundTag, data);
+        assert(boundTag.label() == "red");
+        
+        QtPropertySerializer::registerBindings(&Tag::staticMetaObject, QVector<QtPropertySerializer::PropertyBinding>());
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking bulk and pooled object creation... ";
+    
+    {
+        QObject parent;
+        const QObjectList pets = factory.createN("Pet", 3, &parent);
+        assert(pets.size() == 3);
+        assert(parent.children() == pets);
+        assert(factory.createN("Unknown", 3, &parent).isEmpty());
+        
+        // Freed blocks are reused.
+        QtPropertySerializer::ObjectPool pool(sizeof(Pet));
+        void *block = pool.allocate();
+        pool.deallocate(block);
+        assert(pool.allocate() == block);
+        assert(pool.allocate(5).size() == 5);
+        
+        // If a constructor throws, the objects already created are deleted and every block goes back to the pool.
+        QtPropertySerializer::ObjectFactory fragileFactory;
+        fragileFactory.registerPooledClass<Fragile>();
+        QVector<void*> blocks = Fragile::pool().allocate(4);
+        for(void *fragileBlock : blocks)
+            Fragile::pool().deallocate(fragileBlock);
+        QObject fragileParent;
+        Fragile::countdown() = 2;
+        bool threw = false;
+        try {
+            fragileFactory.createN("Fragile", 4, &fragileParent);
+        } catch(const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        assert(fragileParent.children().isEmpty());
+        QVector<void*> returnedBlocks = Fragile::pool().allocate(4);
+        std::sort(blocks.begin(), blocks.end());
+        std::sort(returnedBlocks.begin(), returnedBlocks.end());
+        assert(returnedBlocks == blocks);
+        
+        // Missing children in a list are created together.
+        QVariantList petDataList;
+        for(int i = 0; i < 3; ++i) {
+            QVariantMap petData;
+            petData["objectName"] = "new" + QString::number(i);
+            petDataList.append(petData);
+        }
+        QVariantMap parentData;
+        parentData["Pet"] = petDataList;
+        QtPropertySerializer::Statistics statistics;
+        QObject newParent;
+        QtPropertySerializer::deserialize(&newParent, parentData, &factory, QtPropertySerializer::NoDeserializeFlags, NULL, &statistics);
+        assert(statistics.counts.objectsCreated == 3);
+        assert(newParent.children().size() == 3);
+        assert(newParent.findChild<Pet*>("new2"));
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking lazy loading of a JSON file... ";
+    
+    {
+        QtPropertySerializer::writeJson(&jane, "jane_lazy.json");
+        Person expectedJane;
+        QtPropertySerializer::readJson(&expectedJane, "jane_lazy.json", &factory);
+        
+        // Only Jane's children are created.
+        QtPropertySerializer::LazyDocument document;
+        Person lazyJane;
+        document.open(&lazyJane, "jane_lazy.json", 1, &factory);
+        assert(lazyJane.children().size() == 2);
+        Person *lazyJosephine = lazyJane.findChild<Person*>("Josephine", Qt::FindDirectChildrenOnly);
+        assert(lazyJosephine->children().isEmpty());
+        assert(document.isPending(lazyJosephine));
+        assert(document.pendingSize() > 0);
+        
+        document.materialize(lazyJosephine);
+        assert(!document.isPending(lazyJosephine));
+        assert(lazyJosephine->findChild<Pet*>("Spot")->species == spot->species);
+        
+        foreach(QObject *object, document.pendingObjects())
+            document.materialize(object);
+        assert(document.pendingSize() == 0);
+        assert(QtPropertySerializer::serialize(&lazyJane) == QtPropertySerializer::serialize(&expectedJane));
+    }
+    
+    // Children stay pending in files with sorted keys, where objectName is not the first key.
+    // A childDepth of 0 creates nothing, and 1 creates only the direct children.
+    {
+        QFile file("jane_sorted.json");
+        file.open(QIODevice::WriteOnly);
+        file.write(QJsonDocument::fromVariant(QtPropertySerializer::serialize(&jane)).toJson());
+        file.close();
+        Person expectedJane;
+        QtPropertySerializer::readJson(&expectedJane, "jane_sorted.json", &factory);
+        
+        QtPropertySerializer::LazyDocument document;
+        Person lazyJane;
+        document.open(&lazyJane, "jane_sorted.json", 0, &factory);
+        assert(lazyJane.children().isEmpty());
+        assert(document.isPending(&lazyJane));
+        
+        document.materialize(&lazyJane, 0);
+        assert(lazyJane.children().isEmpty());
+        assert(document.isPending(&lazyJane));
+        
+        document.materialize(&lazyJane, 1);
+        assert(!document.isPending(&lazyJane));
+        assert(lazyJane.children().size() == 2);
+        Person *lazyJosephine = lazyJane.findChild<Person*>("Josephine", Qt::FindDirectChildrenOnly);
+        assert(lazyJosephine->children().isEmpty());
+        assert(document.isPending(lazyJosephine));
+        
+        document.materialize(lazyJosephine, 1);
+        assert(lazyJosephine->findChild<Pet*>("Spot")->species == spot->species);
+        assert(document.pendingSize() == 0);
+        assert(QtPropertySerializer::serialize(&lazyJane) == QtPropertySerializer::serialize(&expectedJane));
+    }
+    
+    // A child whose first key starts with '$' but which is not a binary array stays pending too.
+    {
+        QFile file("dollar_lazy.json");
+        file.open(QIODevice::WriteOnly);
+        file.write("{\"objectName\": \"Jane\", \"Person\": {\"$note\": \"adopted\", \"objectName\": \"Kid\"}}");
+        file.close();
+        QtPropertySerializer::LazyDocument document;
+        Person lazyJane;
+        document.open(&lazyJane, "dollar_lazy.json", 0, &factory);
+        assert(lazyJane.children().isEmpty());
+        assert(document.isPending(&lazyJane));
+        document.materialize(&lazyJane);
+        assert(lazyJane.findChild<Person*>("Kid", Qt::FindDirectChildrenOnly));
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking selected paths... ";
+    
+    {
+        // Only Spot's species and the objects on the way to it.
+        QVariantMap data = QtPropertySerializer::serialize(&jane, QtPropertySerializer::Selector("Person[Josephine]/Pet/species"));
+        assert(data.size() == 2);
+        assert(data["objectName"].toString() == jane.objectName());
+        QVariantMap josephineData = data["Person"].toMap();
+        assert(josephineData.size() == 2);
+        QVariantMap spotData = josephineData["Pet"].toMap();
+        assert(spotData.size() == 2);
+        assert(spotData["species"].toString() == spot->species);
+        
+        // Heights at any depth. Pets have no height, so they are left out.
+        data = QtPropertySerializer::serialize(&jane, QtPropertySerializer::Selector("**/height"));
+        assert(data["height"].toInt() == jane.heightInCm);
+        assert(data["Person"].toList().size() == 2);
+        assert(!data["Person"].toList().at(1).toMap().contains("Pet"));
+        
+        // Only John's height is applied.
+        Person changedJane;
+        QtPropertySerializer::deserialize(&changedJane, QtPropertySerializer::serialize(&jane), &factory);
+        changedJane.heightInCm = 1;
+        changedJane.findChild<Person*>("John")->heightInCm = 2;
+        changedJane.findChild<Person*>("Josephine")->heightInCm = 3;
+        Person partialJane;
+        QtPropertySerializer::deserialize(&partialJane, QtPropertySerializer::serialize(&jane), &factory);
+        QtPropertySerializer::deserialize(&partialJane, QtPropertySerializer::serialize(&changedJane), QtPropertySerializer::Selector("Person[John]/height"), &factory);
+        assert(partialJane.heightInCm == jane.heightInCm);
+        assert(partialJane.findChild<Person*>("John")->heightInCm == 2);
+        assert(partialJane.findChild<Person*>("Josephine")->heightInCm == josephine->heightInCm);
+        
+        // Unselected entries do not create children.
+        Person emptyJane;
+        QtPropertySerializer::deserialize(&emptyJane, QtPropertySerializer::serialize(&jane), QtPropertySerializer::Selector("Person[John]/height"), &factory);
+        assert(emptyJane.children().size() == 1);
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking parallel JSON output... ";
+    
+    for(QJsonDocument::JsonFormat format : {QJsonDocument::Indented, QJsonDocument::Compact}) {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeJson(&jane, &buffer, -1, true, format);
+        QBuffer parallelBuffer;
+        parallelBuffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeJsonParallel(&jane, &parallelBuffer, -1, true, format);
+        assert(parallelBuffer.data() == buffer.data());
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking binary arrays... ";
+    
+    {
+        Trace trace;
+        trace.setObjectName("trace");
+        for(int i = 0; i < 1000; ++i)
+            trace.samples.append(i / 3.0);
+        trace.counts << 1 << -2 << 3;
+        trace.raw = QByteArray("\0\1\2\xff", 4);
+        
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeJson(&trace, &buffer);
+        buffer.close();
+        assert(buffer.data().contains("\"$binary\""));
+        
+        // Exact types and values, streamed or through a QVariantMap.
+        buffer.open(QIODevice::ReadOnly);
+        Trace jsonTrace;
+        QtPropertySerializer::readJson(&jsonTrace, &buffer);
+        assert(jsonTrace.samples == trace.samples);
+        assert(jsonTrace.counts == trace.counts);
+        assert(jsonTrace.raw == trace.raw);
+        Trace mappedTrace;
+        QtPropertySerializer::deserialize(&mappedTrace, QJsonDocument::fromJson(buffer.data()).toVariant().toMap());
+        assert(mappedTrace.samples == trace.samples);
+        assert(mappedTrace.raw == trace.raw);
+        
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+        QBuffer cborBuffer;
+        cborBuffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeCbor(&trace, &cborBuffer);
+        cborBuffer.close();
+        cborBuffer.open(QIODevice::ReadOnly);
+        Trace cborTrace;
+        QtPropertySerializer::readCbor(&cborTrace, &cborBuffer);
+        assert(cborTrace.samples == trace.samples);
+        assert(cborTrace.counts == trace.counts);
+        assert(cborTrace.raw == trace.raw);
+#endif
+    }
+    
+    {
+        // Binary arrays of objects at the eager boundary of a lazy document are properties, not pending children.
+        Person owner("owner");
+        Trace *trace = new Trace;
+        trace->setObjectName("trace");
+        trace->samples << 1.5 << 2.5;
+        trace->counts << 7;
+        trace->raw = "abc";
+        trace->setParent(&owner);
+        QtPropertySerializer::writeJson(&owner, "trace_lazy.json");
+        
+        QtPropertySerializer::ObjectFactory traceFactory;
+        traceFactory.registerCreator("Trace", traceFactory.defaultCreator<Trace>);
+        Person lazyOwner;
+        QtPropertySerializer::LazyDocument document;
+        document.open(&lazyOwner, "trace_lazy.json", 1, &traceFactory);
+        Trace *lazyTrace = lazyOwner.findChild<Trace*>("trace");
+        assert(lazyTrace);
+        assert(lazyTrace->samples == trace->samples);
+        assert(lazyTrace->counts == trace->counts);
+        assert(lazyTrace->raw == trace->raw);
+        assert(!document.isPending(lazyTrace));
+        assert(document.pendingSize() == 0);
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking content hashing... ";
+    
+    {
+        assert(QtPropertySerializer::contentHash(&jane) == QtPropertySerializer::contentHash(QtPropertySerializer::serialize(&jane)));
+        
+        // Equal trees have equal hashes.
+        Person janeCopy;
+        QtPropertySerializer::deserialize(&janeCopy, QtPropertySerializer::serialize(&jane), &factory);
+        Person otherJaneCopy;
+        QtPropertySerializer::deserialize(&otherJaneCopy, QtPropertySerializer::serialize(&jane), &factory);
+        const QByteArray janeHash = QtPropertySerializer::contentHash(&janeCopy);
+        assert(QtPropertySerializer::contentHash(&otherJaneCopy) == janeHash);
+        
+        // Cached hashes are updated for changed objects only.
+        QtPropertySerializer::ChangeTracker tracker;
+        tracker.track(&janeCopy);
+        assert(tracker.hash() == janeHash);
+        Pet *copySpot = janeCopy.findChild<Pet*>("Spot");
+        copySpot->setProperty("vaccinated", false);
+        assert(tracker.hash() != janeHash);
+        assert(tracker.hash() == QtPropertySerializer::contentHash(&janeCopy));
+        copySpot->setProperty("vaccinated", true);
+        assert(tracker.hash() == janeHash);
+        Pet *rex = new Pet("Rex");
+        rex->setParent(janeCopy.findChild<Person*>("John"));
+        assert(tracker.hash() == QtPropertySerializer::contentHash(&janeCopy));
+        assert(tracker.serialize() == QtPropertySerializer::serialize(&janeCopy));
+        
+        // Unchanged data is not written again.
+        QtPropertySerializer::AsyncWriter writer;
+        writer.setSkipUnchangedWrites(true);
+        assert(writer.writeJson(&jane, "jane_hashed.json").result());
+        QFile file("jane_hashed.json");
+        file.open(QIODevice::WriteOnly);
+        file.write("{}");
+        file.close();
+        assert(writer.writeJson(&jane, "jane_hashed.json").result());
+        assert(QtPropertySerializer::readJson("jane_hashed.json").isEmpty());
+        assert(writer.writeJson(&janeCopy, "jane_hashed.json").result());
+        assert(QtPropertySerializer::readJson("jane_hashed.json") == QJsonDocument::fromVariant(QtPropertySerializer::serialize(&janeCopy)).toVariant().toMap());
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking journaled autosave... ";
+    
+    {
+        QFile::remove("jane_journal.json");
+        QFile::remove("jane_journal.json.journal");
+        Person janeCopy;
+        QtPropertySerializer::deserialize(&janeCopy, QtPropertySerializer::serialize(&jane), &factory);
+        
+        // The first open() writes a snapshot. Saves append only their changes.
+        QtPropertySerializer::Journal journal;
+        journal.open(&janeCopy, "jane_journal.json", &factory);
+        assert(QFile::exists("jane_journal.json"));
+        const qint64 headerSize = journal.journalSize();
+        assert(!journal.save());
+        janeCopy.findChild<Person*>("John")->heightInCm = 191;
+        Pet *rex = new Pet("Rex");
+        rex->species = "cat";
+        rex->setParent(&janeCopy);
+        assert(journal.save());
+        assert(journal.journalSize() > headerSize);
+        assert(journal.journalSize() - headerSize < QFile("jane_journal.json").size());
+        
+        // Loading replays the journal over the snapshot.
+        QtPropertySerializer::writeJson(&janeCopy, "jane_journal_expected.json");
+        Person expectedJane;
+        QtPropertySerializer::readJson(&expectedJane, "jane_journal_expected.json", &factory);
+        {
+            Person loadedJane;
+            QtPropertySerializer::Journal loadedJournal;
+            loadedJournal.open(&loadedJane, "jane_journal.json", &factory);
+            assert(QtPropertySerializer::serialize(&loadedJane) == QtPropertySerializer::serialize(&expectedJane));
+        }
+        
+        // Replayed saves address the same children as in the live tree after a named child is removed and re-added.
+        delete janeCopy.findChild<Person*>("John");
+        Person *newJohn = new Person("John");
+        newJohn->heightInCm = 192;
+        newJohn->setParent(&janeCopy);
+        assert(journal.save());
+        janeCopy.findChild<Person*>("Josephine")->heightInCm = 55;
+        assert(journal.save());
+        QtPropertySerializer::writeJson(&janeCopy, "jane_journal_expected.json");
+        {
+            Person reorderedJane;
+            QtPropertySerializer::readJson(&reorderedJane, "jane_journal_expected.json", &factory);
+            Person loadedJane;
+            QtPropertySerializer::Journal loadedJournal;
+            loadedJournal.open(&loadedJane, "jane_journal.json", &factory);
+            assert(QtPropertySerializer::serialize(&loadedJane) == QtPropertySerializer::serialize(&reorderedJane));
+            assert(loadedJane.findChild<Person*>("Josephine")->heightInCm == 55);
+            assert(loadedJane.findChild<Person*>("John")->heightInCm == 192);
+        }
+        
+        // Compaction folds the journal into the snapshot.
+        journal.setCompactThreshold(0);
+        janeCopy.findChild<Person*>("John")->heightInCm = 190;
+        assert(journal.save());
+        journal.waitForCompaction();
+        assert(journal.journalSize() == headerSize);
+        QtPropertySerializer::writeJson(&janeCopy, "jane_journal_expected.json");
+        Person compactedJane;
+        QtPropertySerializer::readJson(&compactedJane, "jane_journal_expected.json", &factory);
+        {
+            Person loadedJane;
+            QtPropertySerializer::Journal loadedJournal;
+            loadedJournal.open(&loadedJane, "jane_journal.json", &factory);
+            assert(QtPropertySerializer::serialize(&loadedJane) == QtPropertySerializer::serialize(&compactedJane));
+        }
+        
+        // A torn record (e.g. after a crash) is dropped when loading.
+        journal.close();
+        QFile journalFile("jane_journal.json.journal");
+        journalFile.open(QIODevice::WriteOnly | QIODevice::Append);
+        journalFile.write("{\"patch\": [{\"op\": ");
+        journalFile.close();
+        {
+            Person loadedJane;
+            QtPropertySerializer::Journal loadedJournal;
+            loadedJournal.open(&loadedJane, "jane_journal.json", &factory);
+            assert(QtPropertySerializer::serialize(&loadedJane) == QtPropertySerializer::serialize(&compactedJane));
+            assert(loadedJournal.journalSize() == headerSize);
+        }
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+    std::cout << "Checking NDJSON streams... ";
+    
+    {
+        QList<QObject*> pets;
+        for(int i = 0; i < 5000; ++i) {
+            Pet *pet = new Pet("pet" + QString::number(i));
+            pet->species = i % 2 ? "cat" : "dog";
+            pets.append(pet);
+        }
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeNdjson(pets, &buffer);
+        buffer.close();
+        assert(buffer.data().count('\n') == pets.size());
+        
+        // Objects are created on this thread as the records arrive.
+        for(bool parallel : {false, true}) {
+            QList<QObject*> readPets;
+            QtPropertySerializer::NdjsonCallback callback = [&readPets, &factory](const QVariantMap &data) {
+                QObject *pet = factory.create("Pet");
+                QtPropertySerializer::deserialize(pet, data, &factory);
+                readPets.append(pet);
+                return true;
+            };
+            buffer.open(QIODevice::ReadOnly);
+            const qint64 count = parallel ? QtPropertySerializer::readNdjsonParallel(&buffer, callback) : QtPropertySerializer::readNdjson(&buffer, callback);
+            buffer.close();
+            assert(count == pets.size());
+            assert(QtPropertySerializer::serialize(readPets) == QtPropertySerializer::serialize(pets));
+            qDeleteAll(readPets);
+        }
+        
+        // Stop after the first record.
+        buffer.open(QIODevice::ReadOnly);
+        assert(QtPropertySerializer::readNdjsonParallel(&buffer, [](const QVariantMap&) { return false; }) == 1);
+        buffer.close();
+        
+        // Reading on the pool's only thread parses the batches there instead of waiting for them.
+        struct ReadTask : public QRunnable
+        {
+            QIODevice *device;
+            QThreadPool *pool;
+            qint64 count;
+            
+            void run() override { count = QtPropertySerializer::readNdjsonParallel(device, [](const QVariantMap&) { return true; }, pool); }
+        };
+        QThreadPool pool;
+        pool.setMaxThreadCount(1);
+        ReadTask task;
+        task.setAutoDelete(false);
+        task.device = &buffer;
+        task.pool = &pool;
+        task.count = 0;
+        buffer.open(QIODevice::ReadOnly);
+        pool.start(&task);
+        pool.waitForDone();
+        buffer.close();
+        assert(task.count == pets.size());
+        qDeleteAll(pets);
+    }
+    
+    std::cout << "OK" << std::endl;
+    
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    std::cout << "Checking CBOR map-like values and write errors... ";
+    
+    {
+        // Keys of QVariantHash values (also nested in lists) are interned like property names,
+        // so properties after them still decode to the right names.
+        Pet pet("Felix");
+        pet.species = "cat";
+        QVariantHash hash;
+        hash["x"] = 1;
+        hash["y"] = "two";
+        pet.setProperty("aHash", hash);
+        pet.setProperty("aList", QVariantList() << QVariant(hash) << "three");
+        pet.setProperty("zeta", 4);
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeCbor(&pet, &buffer);
+        buffer.close();
+        buffer.open(QIODevice::ReadOnly);
+        const QVariantMap data = QtPropertySerializer::readCbor(&buffer);
+        assert(data.size() == 5);
+        assert(data["objectName"].toString() == "Felix");
+        assert(data["species"].toString() == "cat");
+        assert(data["aHash"].toMap()["x"].toInt() == 1);
+        assert(data["aHash"].toMap()["y"].toString() == "two");
+        assert(data["aList"].toList().at(0).toMap()["y"].toString() == "two");
+        assert(data["aList"].toList().at(1).toString() == "three");
+        assert(data["zeta"].toInt() == 4);
+        
+        // Keys of maps inside other tagged values are interned as well, including keys
+        // that were already interned (e.g. "species"), and decode to the same names.
+        QCborMap taggedMap;
+        taggedMap.insert(QString("species"), QString("lion"));
+        taggedMap.insert(QString("x"), 1);
+        pet.setProperty("aTagged", QVariant::fromValue(QCborValue(QCborTag(40000), taggedMap)));
+        // Re-add zeta so that it is written after the tagged value.
+        pet.setProperty("zeta", QVariant());
+        pet.setProperty("zeta", 5);
+        buffer.close();
+        buffer.setData(QByteArray());
+        buffer.open(QIODevice::WriteOnly);
+        QtPropertySerializer::writeCbor(&pet, &buffer);
+        buffer.close();
+        buffer.open(QIODevice::ReadOnly);
+        const QVariantMap taggedData = QtPropertySerializer::readCbor(&buffer);
+        const QCborValue tagged = taggedData["aTagged"].value<QCborValue>();
+        assert(tagged.isTag() && tagged.tag() == QCborTag(40000));
+        assert(tagged.taggedValue().toMap() == taggedMap);
+        assert(taggedData["species"].toString() == "cat");
+        assert(taggedData["zeta"].toInt() == 5);
+        
+        // Failed writes throw for any kind of device.
+        FailingDevice device;
+        bool threw = false;
+        try {
+            QtPropertySerializer::writeCbor(&pet, &device);
+        } catch(const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+    
+    std::cout << "OK" << std::endl;
+#endif
+    
     return 0;
 }
@@ -8,9 +8,17 @@
 #ifndef __test_QtPropertySerializer_H__
 #define __test_QtPropertySerializer_H__
 
+#include <QByteArray>
 #include <QDate>
+#include <QIODevice>
+#include <QList>
 #include <QObject>
 #include <QString>
+#include <QVector>
+
+#include <stdexcept>
+
+#include "QtPropertySerializer.h"
 
 class Pet : public QObject
 {
@@ -44,4 +52,72 @@ public:
     Person(const QString &name = "") { setObjectName(name); }
 };
 
+class Trace : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QVector<double> samples MEMBER samples)
+    Q_PROPERTY(QList<int> counts MEMBER counts)
+    Q_PROPERTY(QByteArray raw MEMBER raw)
+
+public:
+    QVector<double> samples;
+    QList<int> counts;
+    QByteArray raw;
+};
+
+// Qt-style accessors: a const reference getter and a setter that can reject values,
+// and a setter that emits a signal of its own.
+class Tag : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QString label READ label WRITE setLabel)
+    Q_PROPERTY(int weight READ weight WRITE setWeight)
+
+public:
+    const QString& label() const { return _label; }
+    bool setLabel(const QString &label)
+    {
+        if(label.isEmpty())
+            return false;
+        _label = label;
+        return true;
+    }
+    int weight() const { return _weight; }
+    void setWeight(int weight) { _weight = weight; emit weightSet(); }
+
+signals:
+    // Not a NOTIFY signal.
+    void weightSet();
+
+private:
+    QString _label;
+    int _weight = 0;
+};
+
+// Pooled class whose constructor throws when countdown() reaches zero (-1 never throws).
+class Fragile : public QObject, public QtPropertySerializer::PooledAllocation<Fragile>
+{
+    Q_OBJECT
+
+public:
+    static int& countdown() { static int count = -1; return count; }
+
+    Fragile()
+    {
+        if(countdown() >= 0 && countdown()-- == 0)
+            throw std::runtime_error("Fragile: constructor failed");
+    }
+};
+
+// Device whose writes always fail.
+class FailingDevice : public QIODevice
+{
+public:
+    FailingDevice() { open(QIODevice::WriteOnly); }
+
+protected:
+    qint64 readData(char*, qint64) override { return -1; }
+    qint64 writeData(const char*, qint64) override { return -1; }
+};
+
 #endif // __test_QtPropertySerializer_H__